@@ -0,0 +1,23 @@
+#include "arena.hpp"
+
+ArenaBuffer
+PageArena::allocate(const size_t size)
+{
+    if (size > ARENA_MAX_PACKED)
+    {
+        std::shared_ptr<char[]> own =
+            std::make_shared_for_overwrite<char[]>(size);
+        char *data = own.get();
+        return {{data, size}, std::move(own)};
+    }
+
+    if (size > ARENA_BLOCK_SIZE - used_)
+    {
+        // The rest of the old block is lost, it is at most ARENA_MAX_PACKED
+        block_ = std::make_shared_for_overwrite<char[]>(ARENA_BLOCK_SIZE);
+        used_ = 0;
+    }
+    char *data = block_.get() + used_;
+    used_ += size;
+    return {{data, size}, block_};
+}
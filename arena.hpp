@@ -0,0 +1,37 @@
+#ifndef __WLCLIPMGR_ARENA_HPP
+#define __WLCLIPMGR_ARENA_HPP
+
+#include <span>
+#include <memory>
+#include <cstddef>
+
+#define ARENA_BLOCK_SIZE 0x10000
+#define ARENA_MAX_PACKED 0x1000 // bigger allocations get a block of their own
+
+// Memory from a PageArena, owner_ keeps it alive
+struct ArenaBuffer
+{
+    std::span<char> data_;
+    std::shared_ptr<const void> owner_;
+};
+
+/*
+    Memory for the entry data a page decrypts or decompresses. Small
+    entries (mostly text) are packed one after the other into shared
+    blocks, instead of each getting a heap allocation of its own. A block
+    is freed, once nothing points into it anymore, so an entry can
+    outlive the page it was loaded by. Nothing is zeroed, the data is
+    written over right away.
+
+    Not thread safe, like the Clipboard owning it.
+*/
+class PageArena
+{
+    std::shared_ptr<char[]> block_;
+    size_t used_ = ARENA_BLOCK_SIZE;
+
+    public:
+    ArenaBuffer allocate(const size_t size);
+};
+
+#endif // __WLCLIPMGR_ARENA_HPP
@@ -0,0 +1,536 @@
+/*
+    Benchmarks store, list and restore on synthetic pages.
+
+    Every scenario (entry count x entry mix x encryption) runs in its own
+    forked process, so the peak RSS reported is the one of that scenario.
+    The encrypted scenarios use a throwaway GNUPGHOME with a generated
+    key without passphrase, so nothing depends on the users keyring.
+    Results are printed as JSON, to be compared between commits.
+
+    restore is measured up to setting the selection (which needs a
+    compositor): loading the page, promoting and writing it. search looks
+    for a single letter, which reads every text entry of the page. Heap
+    allocations of loading the page and searching it are counted, by
+    replacing the global operator new.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <msgpack.hpp>
+
+#include "clipboard.hpp"
+#include "procblock.hpp"
+#include "mimesniff.hpp"
+#include "thirdParty/argparse/include/argparse/argparse.hpp"
+
+#define BENCH_GPG_USER "wlclipmgr-benchmark"
+#define BENCH_MAX_PAGE_BYTES 0x10000000 // skip scenarios bigger than that
+#define BENCH_IMAGE_SIZE (MAX_SIZE_CLIPBOARD_ENTRY - 0x100)
+
+static std::atomic<size_t> allocations{0};
+
+void *
+operator new(const size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *res = std::malloc(size == 0 ? 1 : size))
+        return res;
+    throw std::bad_alloc{};
+}
+
+void
+operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void
+operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+struct BenchArgs : public argparse::Args
+{
+    size_t &repeat_ = kwarg("r,repeat",
+        "How often to measure each operation.").set_default(5);
+    bool &quick_ = flag("quick", "Only the small scenarios.");
+    std::string &output_ = kwarg("o,output",
+        "Write the JSON there instead of stdout.").set_default("");
+};
+
+enum class EntryMix
+{
+    text,   // 8 to 256 bytes of text
+    mixed,  // mostly text, every 10th a 64 KiB to 1 MiB png
+    images  // all pngs of almost MAX_SIZE_CLIPBOARD_ENTRY
+};
+
+struct Scenario
+{
+    size_t entries_;
+    EntryMix mix_;
+    bool encrypted_;
+};
+
+static const char *
+mixName(const EntryMix mix)
+{
+    switch (mix)
+    {
+        case EntryMix::text: return "text";
+        case EntryMix::mixed: return "mixed";
+        case EntryMix::images: return "images";
+    }
+    return "";
+}
+
+static size_t
+entrySize(const EntryMix mix, const size_t index, std::mt19937_64 &rng)
+{
+    const bool isImage = mix == EntryMix::images ||
+        (mix == EntryMix::mixed && index % 10 == 9);
+    if (mix == EntryMix::images)
+        return BENCH_IMAGE_SIZE;
+    if (isImage)
+        return std::uniform_int_distribution<size_t>{0x10000, 0x100000}(rng);
+    return std::uniform_int_distribution<size_t>{8, 256}(rng);
+}
+
+// Text, or random data behind a png signature, so xdgmime sniffs image/png
+static std::vector<char>
+makeEntry(const EntryMix mix, const size_t index, std::mt19937_64 &rng)
+{
+    const size_t size = entrySize(mix, index, rng);
+    std::vector<char> data(size);
+    if (size > 256)
+    {
+        static const char signature[] = "\x89PNG\r\n\x1a\n";
+        for (char &c : data)
+            c = static_cast<char>(rng());
+        std::copy(signature, signature + 8, data.begin());
+        return data;
+    }
+    static const char words[] = "abcdefghijklmnopqrstuvwxyz   \n";
+    for (char &c : data)
+        c = words[rng() % (sizeof(words) - 1)];
+    return data;
+}
+
+static size_t
+estimatePageSize(const Scenario &scenario)
+{
+    switch (scenario.mix_)
+    {
+        case EntryMix::text: return scenario.entries_ * 132;
+        case EntryMix::mixed: return scenario.entries_ / 10 * 0x88000;
+        case EntryMix::images: return scenario.entries_ * BENCH_IMAGE_SIZE;
+    }
+    return 0;
+}
+
+// Ingest reads from a fd, hand it the data through a memfd
+static void
+feed(Ingest &selection, const std::vector<char> &data)
+{
+    const int fd = memfd_create("wlclipmgr-benchmark", MFD_CLOEXEC);
+    if (fd < 0 || write(fd, data.data(), data.size()) !=
+            static_cast<ssize_t>(data.size()))
+        throw std::runtime_error("Failed to fill the memfd!");
+    lseek(fd, 0, SEEK_SET);
+    selection.readAll(fd);
+    close(fd);
+}
+
+using Clock = std::chrono::steady_clock;
+
+static double
+msSince(const Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+// Median and spread of repeated measurements
+struct Timing
+{
+    std::vector<double> samples_;
+
+    void add(const double ms) { samples_.push_back(ms); }
+    double median() const
+    {
+        if (samples_.empty())
+            return 0;
+        std::vector<double> sorted = samples_;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+    double min() const
+    {
+        return samples_.empty() ? 0 :
+            *std::min_element(samples_.begin(), samples_.end());
+    }
+    double max() const
+    {
+        return samples_.empty() ? 0 :
+            *std::max_element(samples_.begin(), samples_.end());
+    }
+};
+
+static std::ostream &
+operator<<(std::ostream &os, const Timing &timing)
+{
+    return os << "{\"median\": " << timing.median() << ", \"min\": "
+        << timing.min() << ", \"max\": " << timing.max() << "}";
+}
+
+// Clipboard prints while listing and restoring, that's not what we want
+class MuteStdout
+{
+    std::ofstream devNull_{"/dev/null"};
+    std::streambuf *old_;
+
+    public:
+    MuteStdout() : old_{std::cout.rdbuf(devNull_.rdbuf())} {}
+    ~MuteStdout() { std::cout.rdbuf(old_); }
+};
+
+static std::string
+runScenario(const Scenario &scenario, const fs::path &dir,
+        const size_t repeat)
+{
+    const fs::path pagePath = dir / ("page" + std::to_string(
+                scenario.entries_) + mixName(scenario.mix_) +
+            (scenario.encrypted_ ? "gpg" : "plain"));
+    const std::string gpgUser = scenario.encrypted_ ? BENCH_GPG_USER : "";
+    const bool notSecure = !scenario.encrypted_;
+    std::mt19937_64 rng{scenario.entries_};
+
+    Timing ingest, addEntry, writePage, fill, setMimeType, unpack;
+    std::vector<std::vector<char>> samples;
+    {
+        // Fill the page, one store after the other
+        Clipboard clipboard{pagePath, gpgUser, notSecure};
+        clipboard.loadPage();
+        const Clock::time_point fillStart = Clock::now();
+        for (size_t i = 0; i < scenario.entries_; i++)
+        {
+            const std::vector<char> data = makeEntry(scenario.mix_, i, rng);
+            if (samples.size() < 10)
+                samples.push_back(data);
+
+            Ingest selection{MAX_SIZE_CLIPBOARD_ENTRY};
+            Clock::time_point start = Clock::now();
+            feed(selection, data);
+            ingest.add(msSince(start));
+
+            start = Clock::now();
+            const bool added = clipboard.addEntry(std::move(selection), "");
+            addEntry.add(msSince(start));
+
+            start = Clock::now();
+            if (added)
+                clipboard.writePage();
+            writePage.add(msSince(start));
+        }
+        fill.add(msSince(fillStart));
+    }
+
+    // What ClipboardEntry::setMimeType does for every new entry. The
+    // samples were sniffed while filling, a random hash misses the cache.
+    for (const std::vector<char> &sample : samples)
+    {
+        ContentHash hash;
+        for (unsigned char &c : hash)
+            c = static_cast<unsigned char>(rng());
+        const Clock::time_point start = Clock::now();
+        sniffMimeType(hash, sample);
+        setMimeType.add(msSince(start));
+    }
+
+    // Pages from before the log format were a msgpack'ed deque
+    {
+        msgpack::sbuffer legacy;
+        msgpack::packer<msgpack::sbuffer> packer{legacy};
+        packer.pack_array(samples.size());
+        for (const std::vector<char> &sample : samples)
+        {
+            packer.pack_array(3);
+            packer.pack(sample);
+            packer.pack(sample.size());
+            packer.pack(std::string{"text/plain"});
+        }
+        const std::vector<char> data(legacy.data(),
+                legacy.data() + legacy.size());
+        for (size_t i = 0; i < repeat; i++)
+        {
+            Clipboard clipboard{dir / "legacy", "", true};
+            const Clock::time_point start = Clock::now();
+            clipboard.unpackEntries(data);
+            unpack.add(msSince(start));
+        }
+    }
+
+    // End to end, like separate wlclipmgr invocations would
+    Timing store, storeLoad, list, restore, search;
+    size_t loadAllocations = 0;
+    size_t searchAllocations = 0;
+    MuteStdout mute;
+    for (size_t i = 0; i < repeat; i++)
+    {
+        Clock::time_point start = Clock::now();
+        {
+            Clipboard clipboard{pagePath, gpgUser, notSecure};
+            clipboard.loadPage();
+            storeLoad.add(msSince(start));
+            Ingest selection{MAX_SIZE_CLIPBOARD_ENTRY};
+            feed(selection, makeEntry(scenario.mix_, i, rng));
+            if (clipboard.addEntry(std::move(selection), ""))
+                clipboard.writePage();
+            if (clipboard.needsCompaction())
+                clipboard.compactPage();
+        }
+        store.add(msSince(start));
+
+        start = Clock::now();
+        {
+            Clipboard clipboard{pagePath, gpgUser, notSecure};
+            clipboard.loadPage();
+            ListRenderer renderer{ListFormat::text};
+            clipboard.listEntries(renderer, 10);
+            renderer.write();
+        }
+        list.add(msSince(start));
+
+        start = Clock::now();
+        {
+            Clipboard clipboard{pagePath, gpgUser, notSecure};
+            clipboard.loadPage();
+            clipboard.restore(scenario.entries_ / 2);
+        }
+        restore.add(msSince(start));
+
+        start = Clock::now();
+        {
+            Clipboard clipboard{pagePath, gpgUser, notSecure};
+            size_t before = allocations;
+            clipboard.loadPage();
+            loadAllocations = allocations - before;
+            before = allocations;
+            clipboard.search(SearchQuery{"e", false, false});
+            searchAllocations = allocations - before;
+        }
+        search.add(msSince(start));
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::stringstream res;
+    res << "{\"entries\": " << scenario.entries_
+        << ", \"mix\": \"" << mixName(scenario.mix_) << "\""
+        << ", \"encrypted\": " << (scenario.encrypted_ ? "true" : "false")
+        << ", \"page_bytes\": " << fs::file_size(pagePath.string() + ".dat")
+        << ", \"store_ms\": " << store
+        << ", \"list_ms\": " << list
+        << ", \"restore_ms\": " << restore
+        << ", \"search_ms\": " << search
+        << ", \"fill_ms\": " << fill.median()
+        << ", \"stages_ms\": {"
+        << "\"ingest\": " << ingest
+        << ", \"addEntry\": " << addEntry
+        << ", \"writePage\": " << writePage
+        << ", \"loadPage\": " << storeLoad
+        << ", \"setMimeType\": " << setMimeType
+        << ", \"unpackEntries\": " << unpack
+        << "}, \"allocations\": {"
+        << "\"loadPage\": " << loadAllocations
+        << ", \"search\": " << searchAllocations
+        << "}, \"peak_rss_kib\": " << usage.ru_maxrss << "}";
+    return res.str();
+}
+
+// Runs the scenario in a child, so its peak RSS is its own
+static std::string
+forkScenario(const Scenario &scenario, const fs::path &dir, const size_t repeat)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("Failed to create a pipe!");
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("Failed to fork!");
+    if (pid == 0)
+    {
+        close(fds[0]);
+        int status = 0;
+        std::string res;
+        try
+        {
+            res = runScenario(scenario, dir, repeat);
+        }
+        catch (const std::exception &err)
+        {
+            std::cerr << "Scenario failed: " << err.what() << std::endl;
+            status = 1;
+        }
+        if (write(fds[1], res.data(), res.size()) !=
+                static_cast<ssize_t>(res.size()))
+            status = 1;
+        _exit(status);
+    }
+
+    close(fds[1]);
+    std::string res;
+    char buf[0x1000];
+    ssize_t got;
+    while ((got = read(fds[0], buf, sizeof(buf))) > 0)
+        res.append(buf, got);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return "";
+    return res;
+}
+
+static bool
+runCommand(const std::vector<std::string> &command)
+{
+    std::vector<char *> argv;
+    for (const std::string &arg : command)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(NULL);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv.data(), environ) != 0)
+        return false;
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// A keyring, that only lives as long as the benchmark
+static void
+setUpGnupgHome(const fs::path &gnupgHome)
+{
+    fs::create_directory(gnupgHome);
+    fs::permissions(gnupgHome, fs::perms::owner_all);
+    setenv("GNUPGHOME", gnupgHome.c_str(), 1);
+    if (!runCommand({"gpg", "--batch", "--quiet", "--passphrase", "",
+                "--quick-generate-key", BENCH_GPG_USER, "default", "default",
+                "never"}))
+        throw std::runtime_error("Failed to generate the benchmark key!");
+}
+
+static std::string
+benchProcBlock(const size_t repeat)
+{
+    Timing cold, cached;
+    for (size_t i = 0; i < repeat; i++)
+    {
+        // A new block option starts without cache
+        const std::string blockOption = "pass:10,keepassxc,scary_app" +
+            std::to_string(i);
+        Clock::time_point start = Clock::now();
+        isProcBlocking(blockOption);
+        cold.add(msSince(start));
+        start = Clock::now();
+        isProcBlocking(blockOption);
+        cached.add(msSince(start));
+    }
+    std::stringstream res;
+    res << "{\"cold_ms\": " << cold << ", \"cached_ms\": " << cached << "}";
+    return res.str();
+}
+
+int
+main(int argc, char *argv[])
+{
+    const auto args = argparse::parse<BenchArgs>(argc, argv);
+
+    char dirTemplate[] = "/tmp/wlclipmgr-benchmark-XXXXXX";
+    if (mkdtemp(dirTemplate) == NULL)
+    {
+        std::cerr << "Failed to create a temporary directory!" << std::endl;
+        return -1;
+    }
+    const fs::path dir{dirTemplate};
+
+    std::vector<Scenario> scenarios;
+    const std::vector<size_t> entryCounts = args.quick_ ?
+        std::vector<size_t>{10, 100} :
+        std::vector<size_t>{10, 100, 1000, 10000};
+    for (const bool encrypted : {false, true})
+    {
+        for (const EntryMix mix : {EntryMix::text, EntryMix::mixed,
+                EntryMix::images})
+        {
+            for (const size_t entries : entryCounts)
+            {
+                const Scenario scenario{entries, mix, encrypted};
+                if (estimatePageSize(scenario) <= BENCH_MAX_PAGE_BYTES)
+                    scenarios.push_back(scenario);
+            }
+        }
+    }
+
+    int res = 0;
+    std::stringstream json;
+    try
+    {
+        setUpGnupgHome(dir / "gnupg");
+        json << "{\"procBlock\": " << benchProcBlock(args.repeat_)
+            << ", \"scenarios\": [";
+        bool first = true;
+        for (const Scenario &scenario : scenarios)
+        {
+            std::cerr << "Running " << scenario.entries_ << " "
+                << mixName(scenario.mix_)
+                << (scenario.encrypted_ ? " encrypted" : " plain")
+                << std::endl;
+            const std::string result = forkScenario(scenario, dir,
+                    args.repeat_);
+            if (result.empty())
+            {
+                res = -1;
+                continue;
+            }
+            json << (first ? "\n  " : ",\n  ") << result;
+            first = false;
+        }
+        json << "\n]}" << std::endl;
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << err.what() << std::endl;
+        res = -1;
+    }
+
+    runCommand({"gpgconf", "--kill", "gpg-agent"});
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+
+    if (args.output_.empty())
+        std::cout << json.str();
+    else
+        std::ofstream{args.output_} << json.str();
+    return res;
+}
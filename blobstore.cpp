@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "blobstore.hpp"
+#include "clipboard.hpp"
+#include "sessionkey.hpp"
+#include "pagelog.hpp"
+#include "trace.hpp"
+
+#define SEALED_CHUNK_OVERHEAD (SESSION_NONCE_SIZE + SESSION_TAG_SIZE)
+
+static bool
+writeAll(const int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static std::string
+toHex(const unsigned char *data, const size_t size)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string res;
+    res.reserve(size * 2);
+    for (size_t i = 0; i < size; i++)
+    {
+        res += digits[data[i] >> 4];
+        res += digits[data[i] & 0xf];
+    }
+    return res;
+}
+
+// Binds a sealed chunk to its blob and place in it. The last one is marked,
+// so a blob cut short does not open.
+static uint64_t
+chunkPart(const std::string &name, const uint64_t chunk, const bool last)
+{
+    const ContentHash nameHash = hashContent(name.data(), name.size());
+    uint64_t res;
+    std::memcpy(&res, nameHash.data(), sizeof(res));
+    return (res ^ chunk) ^ (last ? 1ull << 63 : 0);
+}
+
+static uint64_t
+chunkCount(const uint64_t size, const uint32_t chunkSize)
+{
+    return size == 0 ? 0 : (size + chunkSize - 1) / chunkSize;
+}
+
+BlobStore::BlobStore(const fs::path &cacheDir) : dir_{cacheDir / "blobs"}
+{
+}
+
+std::string
+BlobStore::blobName(const std::string &page, const ContentHash &hash,
+        const SessionKey *key)
+{
+    if (key == nullptr)
+        return page + "-" + toHex(hash.data(), hash.size());
+    // The plain hash would tell, whether a blob holds some known data
+    ContentHasher hasher;
+    hasher.update(key->data(), key->size());
+    hasher.update(reinterpret_cast<const char *>(hash.data()), hash.size());
+    const ContentHash keyed = hasher.finish();
+    return page + "-" + toHex(keyed.data(), keyed.size());
+}
+
+void
+BlobStore::write(const std::string &name, const std::span<const char> data,
+        const SessionKey *key) const
+{
+    const fs::path blobPath = path(name);
+    // Named by its content, so it is there already
+    if (fs::exists(blobPath))
+        return;
+    TraceSpan span{"writeBlob"};
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    fs::permissions(dir_, fs::perms::owner_all, ec);
+
+    std::string tmpPath = blobPath.string() + ".XXXXXX";
+    const int fd = mkostemp(tmpPath.data(), O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Failed to create " + tmpPath + ": " +
+                std::strerror(errno));
+
+    BlobHeader header{};
+    std::memcpy(header.magic_, BLOB_MAGIC, sizeof(header.magic_));
+    header.version_ = BLOB_VERSION;
+    header.chunkSize_ = BLOB_CHUNK_SIZE;
+    header.size_ = data.size();
+    header.sealed_ = key != nullptr;
+    bool ok = writeAll(fd, reinterpret_cast<const char *>(&header),
+            sizeof(header));
+    if (key == nullptr)
+        ok = ok && writeAll(fd, data.data(), data.size());
+    else
+    {
+        // One chunk at a time, the sealed blob is never in memory as a whole
+        const uint64_t chunks = chunkCount(data.size(), BLOB_CHUNK_SIZE);
+        for (uint64_t i = 0; ok && i < chunks; i++)
+        {
+            const std::span<const char> chunk = data.subspan(
+                    i * BLOB_CHUNK_SIZE, std::min<size_t>(BLOB_CHUNK_SIZE,
+                        data.size() - i * BLOB_CHUNK_SIZE));
+            const std::vector<char> sealed = key->seal(chunk.data(),
+                    chunk.size(), chunkPart(name, i, i + 1 == chunks));
+            ok = writeAll(fd, sealed.data(), sealed.size());
+        }
+    }
+    if (ok && PageLog::syncPolicy() != SyncPolicy::none)
+        ok = fsync(fd) == 0;
+    const int err = errno;
+    close(fd);
+    if (ok)
+        fs::rename(tmpPath, blobPath, ec);
+    if (!ok || ec)
+    {
+        fs::remove(tmpPath, ec);
+        throw std::runtime_error("Failed to write " + blobPath.string() +
+                ": " + std::strerror(ok ? ec.value() : err));
+    }
+}
+
+// Checks the header against the size of the file
+static const BlobHeader &
+checkBlob(const MappedFile &map, const std::string &name, const bool sealed)
+{
+    const auto damaged = [&]()
+    {
+        return std::runtime_error("Blob " + name + " is damaged!");
+    };
+    if (map.size() < sizeof(BlobHeader))
+        throw damaged();
+    const BlobHeader &header = *reinterpret_cast<const BlobHeader *>(
+            map.data());
+    if (std::memcmp(header.magic_, BLOB_MAGIC, sizeof(header.magic_)) != 0)
+        throw damaged();
+    if (header.version_ > BLOB_VERSION)
+        throw std::runtime_error("Blob " + name +
+                " is from a newer version of wlclipmgr!");
+    if ((header.sealed_ != 0) != sealed || header.chunkSize_ == 0)
+        throw damaged();
+
+    uint64_t expected = sizeof(BlobHeader) + header.size_;
+    if (sealed)
+        expected += chunkCount(header.size_, header.chunkSize_) *
+            SEALED_CHUNK_OVERHEAD;
+    if (map.size() != expected)
+        throw damaged();
+    return header;
+}
+
+std::shared_ptr<const MappedFile>
+BlobStore::map(const std::string &name) const
+{
+    return std::make_shared<const MappedFile>(path(name));
+}
+
+EntryData
+BlobStore::read(const std::string &name, const SessionKey *key) const
+{
+    TraceSpan span{"readBlob"};
+    std::shared_ptr<const MappedFile> blob = map(name);
+    const BlobHeader &header = checkBlob(*blob, name, key != nullptr);
+    const char *data = blob->data() + sizeof(BlobHeader);
+    if (key == nullptr)
+        return {{}, {data, header.size_}, std::move(blob)};
+
+    EntryData res;
+    res.buffer_.reserve(header.size_);
+    const uint64_t chunks = chunkCount(header.size_, header.chunkSize_);
+    for (uint64_t i = 0; i < chunks; i++)
+    {
+        const size_t size = std::min<uint64_t>(header.chunkSize_,
+                header.size_ - i * header.chunkSize_) + SEALED_CHUNK_OVERHEAD;
+        const std::vector<char> chunk = key->open(data, size,
+                chunkPart(name, i, i + 1 == chunks));
+        res.buffer_.insert(res.buffer_.end(), chunk.begin(), chunk.end());
+        data += size;
+    }
+    return res;
+}
+
+bool
+BlobStore::stream(const MappedFile &map, const std::string &name,
+        const SessionKey *key, const int fd)
+{
+    const BlobHeader &header = checkBlob(map, name, key != nullptr);
+    const char *data = map.data() + sizeof(BlobHeader);
+    if (key == nullptr)
+        return writeAll(fd, data, header.size_);
+
+    const uint64_t chunks = chunkCount(header.size_, header.chunkSize_);
+    for (uint64_t i = 0; i < chunks; i++)
+    {
+        const size_t size = std::min<uint64_t>(header.chunkSize_,
+                header.size_ - i * header.chunkSize_) + SEALED_CHUNK_OVERHEAD;
+        std::vector<char> chunk = key->open(data, size,
+                chunkPart(name, i, i + 1 == chunks));
+        const bool ok = writeAll(fd, chunk.data(), chunk.size());
+        explicit_bzero(chunk.data(), chunk.size());
+        if (!ok)
+            return false;
+        data += size;
+    }
+    return true;
+}
+
+void
+BlobStore::collect(const std::string &page,
+        const std::unordered_set<std::string> &keep) const
+{
+    std::error_code ec;
+    if (!fs::is_directory(dir_, ec))
+        return;
+    const std::string prefix = page + "-";
+    for (const fs::directory_entry &file : fs::directory_iterator{dir_, ec})
+    {
+        const std::string name = file.path().filename().string();
+        if (!name.starts_with(prefix) || keep.contains(name))
+            continue;
+        // Not a blob of a page, that just starts with the same name.
+        // Temporary files of an interrupted write go as well.
+        const std::string hash = name.substr(prefix.size(),
+                name.find('.', prefix.size()) - prefix.size());
+        if (hash.size() == CONTENT_HASH_SIZE * 2 &&
+                hash.find('-') == std::string::npos)
+            fs::remove(file.path(), ec);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef __WLCLIPMGR_BLOBSTORE_HPP
+#define __WLCLIPMGR_BLOBSTORE_HPP
+
+#include <span>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <cstdint>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "contenthash.hpp"
+#include "mappedfile.hpp"
+
+#define BLOB_MAGIC "WLCPBLOB"
+#define BLOB_VERSION 1
+#define BLOB_MIN_SIZE 0x400000 // entries this big go to a blob
+#define BLOB_CHUNK_SIZE 0x100000
+
+class SessionKey;
+struct EntryData;
+
+struct BlobHeader
+{
+    char magic_[8];
+    uint32_t version_;
+    uint32_t chunkSize_;
+    uint64_t size_; // of the data
+    uint8_t sealed_;
+    uint8_t reserved_[7];
+};
+static_assert(sizeof(BlobHeader) == 32);
+
+/*
+    Large entries are kept out of the payload log, each in a file of its
+    own in <cache>/blobs, so compacting a page never copies them and they
+    are only mapped, when restored. The data is split into chunks, each
+    sealed on its own with the SessionKey of the page, so restoring can
+    decrypt and send one chunk at a time. Plain blobs are the data as is,
+    behind the header, and get offered straight from the mapping.
+
+    Blobs are named "<page>-<hash>" by the hash of their content (keyed
+    with the SessionKey, so the name says nothing about it), so a page
+    stores the same data once and knows which blobs are its own.
+*/
+class BlobStore
+{
+    const fs::path dir_;
+
+    public:
+    explicit BlobStore(const fs::path &cacheDir);
+
+    static std::string blobName(const std::string &page,
+            const ContentHash &hash, const SessionKey *key);
+    fs::path path(const std::string &name) const { return dir_ / name; }
+
+    // key is null for plain blobs
+    void write(const std::string &name, const std::span<const char> data,
+            const SessionKey *key) const;
+    EntryData read(const std::string &name, const SessionKey *key) const;
+    // The mapping stays valid, even if the blob gets removed
+    std::shared_ptr<const MappedFile> map(const std::string &name) const;
+    // Writes the data of a mapped blob to fd, opening a chunk at a time.
+    // Returns false, if fd went away.
+    static bool stream(const MappedFile &map, const std::string &name,
+            const SessionKey *key, const int fd);
+
+    // Removes the blobs of page, that are not in keep
+    void collect(const std::string &page,
+            const std::unordered_set<std::string> &keep) const;
+};
+
+#endif // __WLCLIPMGR_BLOBSTORE_HPP
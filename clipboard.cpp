@@ -1,14 +1,73 @@
 #include <istream>
+#include <chrono>
+#include <algorithm>
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 
-#include <cctype> // used for isprint()
+#include <cstring>
+
+#include <unistd.h>
 
 #include "clipboard.hpp"
 #include "procblock.hpp"
 #include "gpgmeinterface.hpp"
+#include "trace.hpp"
+#include "mimesniff.hpp"
+#include "pagelock.hpp"
+
+Clipboard::Clipboard(const fs::path &pagePath, const std::string &gpgUserName,
+        bool notSecure) :
+    pagePath_{pagePath},
+    indexLog_{pagePath.string() + ".idx"},
+    payloadLog_{pagePath.string() + ".dat"}, gpgUserName_{gpgUserName},
+    notSecure_{notSecure}, blobs_{pagePath.parent_path()},
+    searchLog_{pagePath.string() + ".tri"}
+{
+    const LogEncryption encryption = notSecure ? LogEncryption::none :
+        LogEncryption::sessionKey;
+    indexLog_.setContent(encryption, LogCodec::none);
+    payloadLog_.setContent(encryption, LogCodec::zstd);
+    searchLog_.setContent(encryption, LogCodec::none);
+}
+
+Clipboard::~Clipboard() = default;
+
+const GpgMEInterface &
+Clipboard::gpgInterface() const
+{
+    return GpgMEInterface::session(gpgUserName_,
+            pagePath_.parent_path() / GPG_KEY_CACHE_FILE);
+}
+
+const SessionKey &
+Clipboard::sessionKey()
+{
+    if (sessionKey_)
+        return *sessionKey_;
+
+    if (!wrappedSessionKey_.empty())
+    {
+        std::vector<char> res = gpgInterface().decrypt(
+                wrappedSessionKey_.data(), wrappedSessionKey_.size());
+        sessionKey_ = SessionKey::fromBytes(res.data(), res.size());
+        explicit_bzero(res.data(), res.size());
+        return *sessionKey_;
+    }
 
-extern "C" {
-#include "thirdParty/xdgmime/src/xdgmime.h"
+    // New page (or one that was not encrypted so far)
+    sessionKey_ = SessionKey::generate();
+    wrappedSessionKey_ = gpgInterface().encrypt(sessionKey_->data(),
+            sessionKey_->size());
+    indexLog_.append(RecordType::sessionKey, 0, recordGpgEncrypted,
+            wrappedSessionKey_.data(), wrappedSessionKey_.size());
+    return *sessionKey_;
+}
+
+const SessionKey *
+Clipboard::blobKey()
+{
+    return notSecure_ ? nullptr : &sessionKey();
 }
 
 void
@@ -17,175 +76,1225 @@ Clipboard::addEntry(const std::string &blockOption)
     if (!blockOption.empty() && isProcBlocking(blockOption))
         return;
 
-    std::freopen(NULL, "rb", stdin);
-    std::vector<char> buffer;
+    Ingest selection{maxEntrySize_};
     try
     {
-        buffer = std::vector<char>{
-            std::istreambuf_iterator<char>{std::cin}, {}
-        };
-    } catch (const std::ios::failure &err) {
+        TraceSpan span{"readStdin"};
+        selection.readAll(STDIN_FILENO);
+    } catch (const std::runtime_error &err) {
         std::cerr << "Failed to read clipboard content!" << std::endl;
         std::cerr << err.what() << std::endl;
         return;
     }
-    const size_t buffSize = buffer.size();
-    if (buffSize == 0)
-        return;
-    if (buffSize > MAX_SIZE_CLIPBOARD_ENTRY)
+    addEntry(std::move(selection), "");
+}
+
+bool
+Clipboard::addEntry(Ingest &&selection, const std::string &blockOption,
+        std::vector<EntryAlternative> &&alternatives)
+{
+    if (!blockOption.empty() && isProcBlocking(blockOption))
+        return false;
+
+    TraceSpan span{"addEntry"};
+    if (selection.size() == 0)
+        return false;
+    if (selection.tooBig())
     {
-        std::cout << "ClipboardEntry size ";
-        std::cout << buffer.size() << " is too big, not saving that!";
+        std::cout << "ClipboardEntry is bigger than ";
+        std::cout << maxEntrySize_ << " bytes, not saving that!";
         std::cout << std::endl;
-        return;
+        return false;
     }
-    ClipboardEntry newEntry{buffer, buffSize};
+    ClipboardEntry newEntry{std::move(selection)};
+    newEntry.alternatives_ = std::move(alternatives);
+
+    if (!entries_.empty() && newEntry == entries_[0])
+        return false;
 
-    if (entries_.empty() || newEntry != entries_[0])
-        entries_.push_front(newEntry);
+    // Copied before, just move the old entry to the front
+    const auto known = hashIndex_.find(newEntry.hash_);
+    if (known != hashIndex_.end())
+    {
+        const auto it = std::find_if(entries_.begin(), entries_.end(),
+            [&](const ClipboardEntry &entry) { return entry.id_ == known->second; });
+        if (it != entries_.end())
+        {
+            promoteEntry(std::distance(entries_.begin(), it));
+            return true;
+        }
+    }
+
+    newEntry.id_ = nextId_++;
+    const EntryRef *ref = history_ ? history_->find(newEntry.hash_) : nullptr;
+    if (ref && ref->page_ != pageName() && newEntry.alternatives_.empty())
+    {
+        // Copied on another day, only store a reference to that entry
+        newEntry.refPage_ = ref->page_;
+        newEntry.refId_ = ref->id_;
+        appendMetaRecord(newEntry);
+    }
+    else
+    {
+        if (PageCodec::usesDictionary(newEntry.mime_))
+            trainDictionary();
+        appendEntry(newEntry);
+    }
+    appendTrigrams(newEntry);
+    hashIndex_.insert_or_assign(newEntry.hash_, newEntry.id_);
+    entries_.push_front(std::move(newEntry));
+    if (retention_.limitsEntries())
+        evict(retention_);
+    return true;
 }
 
 void
-Clipboard::listEntries(const size_t num)
+Clipboard::listEntries(ListRenderer &renderer, const size_t num) const
 {
     for (size_t i = 0; i < num && i < entries_.size(); i++)
+        renderer.add(entries_[i], i);
+}
+
+const ClipboardEntry *
+Clipboard::restore(const size_t index, const bool isCurrentPage)
+{
+    if ((index == 0 && isCurrentPage) || index >= entries_.size())
+    {
+        std::cout << "Nothing to restore" << std::endl;
+        return nullptr;
+    }
+    if (index == 0)
+        return &loadPayload(entries_[0], false);
+    // Move to the front and write before offering the ClipboardEntry.
+    // Makes sure the file is written, before wl-paste invokes wlclipmgr
+    // again, which then finds the entry already at the front.
+    promoteEntry(index);
+    const ClipboardEntry &entry = loadPayload(entries_[0], false);
+    writePage();
+    return &entry;
+}
+
+std::function<void(int)>
+Clipboard::dataWriter(const ClipboardEntry &entry)
+{
+    if (entry.loaded_ || entry.blob_.empty())
+        return {};
+    // Mapped and unwrapped right away, the writer might only run in a
+    // forked process, after the entry got evicted
+    const SessionKey *key = blobKey();
+    std::shared_ptr<const MappedFile> blob = blobs_.map(entry.blob_);
+    return [blob, name = entry.blob_, key](const int fd)
+    {
+        BlobStore::stream(*blob, name, key, fd);
+    };
+}
+
+// An entry, as pages before the page log stored it
+struct LegacyEntry
+{
+    std::vector<char> buffer_;
+    size_t size_;
+    std::string mime_;
+
+    MSGPACK_DEFINE(buffer_, size_, mime_)
+};
+
+void
+Clipboard::unpackEntries(const std::vector<char> &data)
+{
+    unpackEntries(data.data(), data.size());
+}
+
+void
+Clipboard::unpackEntries(const char *data, const size_t size)
+{
+    TraceSpan span{"unpackEntries"};
+    if (size == 0)
+        return;
+
+    // Let the msgpack objects point into data, instead of copying every
+    // entry into the zone first. data outlives the object handle.
+    msgpack::object_handle oh = msgpack::unpack(data, size,
+            [](msgpack::type::object_type, std::size_t, void *)
+            {
+                return true;
+            });
+    msgpack::object obj = oh.get();
+
+    std::vector<LegacyEntry> legacy;
+    obj.convert(legacy);
+    for (LegacyEntry &entry : legacy)
+        entries_.push_back(ClipboardEntry{std::move(entry.buffer_),
+                entry.size_, entry.mime_});
+};
+
+void
+Clipboard::decryptLoadPage(const char *data, const size_t size) noexcept
+{
+    std::vector<char> res;
+    gpgInterface().decrypt(data, size, res);
+
+    unpackEntries(res);
+}
+
+static uint64_t
+fileTimestamp(const fs::path &path)
+{
+    const auto sysTime = std::chrono::file_clock::to_sys(
+            fs::last_write_time(path));
+    return std::chrono::duration_cast<std::chrono::seconds>(
+            sysTime.time_since_epoch()).count();
+}
+
+// Meta record of an entry in the index
+struct EntryMeta
+{
+    size_t size_;
+    std::string mime_;
+    std::string hash_;
+    uint64_t timestamp_;
+    std::string preview_;
+    uint64_t payloadOffset_;
+    // Added later, missing in older records
+    std::string refPage_;
+    uint64_t refId_ = 0;
+    std::vector<EntryAlternative> alternatives_;
+    bool pinned_ = false;
+    std::string blob_;
+    // Older records have the start of the text as preview_
+    bool previewRendered_ = false;
+
+    MSGPACK_DEFINE(size_, mime_, hash_, timestamp_, preview_, payloadOffset_,
+            refPage_, refId_, alternatives_, pinned_, blob_, previewRendered_)
+};
+
+// Associated data for sealing the meta and data (or an alternative's data)
+// of an entry
+static uint64_t
+entryPart(const uint64_t id, const bool isData, const uint16_t part = 0)
+{
+    return (static_cast<uint64_t>(part) << 48) | (id << 1) | isData;
+}
+
+#define DICTIONARY_PART 0xffff // entryPart of the dictionary record
+#define TRIGRAMS_PART 0xfffe // entryPart of trigram records
+
+void
+Clipboard::attachPayloadLog()
+{
+    if (payloadAttached_)
+        return;
+    payloadLog_.attach();
+    payloadAttached_ = true;
+}
+
+void
+Clipboard::appendMetaRecord(const ClipboardEntry &entry)
+{
+    TraceSpan span{"packMeta"};
+    msgpack::sbuffer meta;
+    msgpack::pack(meta, EntryMeta{entry.size_, entry.mime_.str(),
+        hashToString(entry.hash_), entry.timestamp_, entry.preview_,
+        entry.payloadOffset_, entry.refPage_, entry.refId_,
+        entry.alternatives_, entry.pinned_, entry.blob_, true});
+
+    if (notSecure_)
+    {
+        indexLog_.append(RecordType::meta, entry.id_, 0, meta.data(),
+                meta.size());
+        return;
+    }
+    const std::vector<char> sealed = sessionKey().seal(meta.data(),
+            meta.size(), entryPart(entry.id_, false));
+    indexLog_.append(RecordType::meta, entry.id_, recordSealed, sealed.data(),
+            sealed.size());
+}
+
+void
+Clipboard::promoteEntry(const size_t index)
+{
+    const auto it = std::next(entries_.begin(), index);
+    ClipboardEntry promoted = std::move(*it);
+    entries_.erase(it);
+    entries_.push_front(std::move(promoted));
+    indexLog_.append(RecordType::promote, entries_[0].id_, 0, NULL, 0);
+    indexLog_.addGarbage(sizeof(RecordHeader));
+}
+
+uint64_t
+ClipboardEntry::payloadSize() const noexcept
+{
+    if (!refPage_.empty())
+        return 0;
+    uint64_t res = blob_.empty() ? sizeof(RecordHeader) + size_ : 0;
+    for (const EntryAlternative &alternative : alternatives_)
+        res += sizeof(RecordHeader) + alternative.size_;
+    return res;
+}
+
+uint64_t
+ClipboardEntry::storedSize() const noexcept
+{
+    return payloadSize() + (blob_.empty() ? 0 : size_);
+}
+
+void
+Clipboard::removeEntry(const size_t index)
+{
+    const auto it = std::next(entries_.begin(), index);
+    indexLog_.append(RecordType::remove, it->id_, 0, NULL, 0);
+    indexLog_.addGarbage(sizeof(RecordHeader));
+    payloadLog_.addGarbage(it->payloadSize());
+    if (!it->blob_.empty())
+        blobsDropped_ = true;
+    const auto known = hashIndex_.find(it->hash_);
+    if (known != hashIndex_.end() && known->second == it->id_)
+        hashIndex_.erase(known);
+    // Its trigrams are dropped, when the search index is loaded next
+    searchIndex_.erase(it->id_);
+    entries_.erase(it);
+}
+
+bool
+Clipboard::pin(const size_t index, const bool pinned)
+{
+    if (index >= entries_.size())
+        return false;
+    ClipboardEntry &entry = entries_[index];
+    if (entry.pinned_ == pinned)
+        return true;
+    entry.pinned_ = pinned;
+    indexLog_.append(pinned ? RecordType::pin : RecordType::unpin, entry.id_,
+            0, NULL, 0);
+    indexLog_.addGarbage(sizeof(RecordHeader));
+    return true;
+}
+
+bool
+Clipboard::hasPinned() const noexcept
+{
+    return std::any_of(entries_.begin(), entries_.end(),
+            [](const ClipboardEntry &entry) { return entry.pinned_; });
+}
+
+size_t
+Clipboard::evict(const RetentionPolicy &policy, const bool keepFront)
+{
+    if (entries_.empty())
+        return 0;
+    TraceSpan span{"evict"};
+    const uint64_t now = std::time(0);
+    const uint64_t maxAge = policy.maxAgeDays_ * SECONDS_PER_DAY;
+    uint64_t bytes = 0;
+    for (const ClipboardEntry &entry : entries_)
+        bytes += entry.storedSize();
+
+    // Oldest first, the front is the current selection
+    size_t evicted = 0;
+    for (size_t i = entries_.size(); i-- > (keepFront ? 1 : 0);)
     {
         const ClipboardEntry &entry = entries_[i];
-        std::cout << i << " " << entry << std::endl;
+        const bool tooMany = policy.maxEntries_ != 0 &&
+            entries_.size() > policy.maxEntries_;
+        const bool tooBig = policy.maxBytes_ != 0 && bytes > policy.maxBytes_;
+        const bool tooOld = maxAge != 0 && entry.timestamp_ + maxAge < now;
+        if (entry.pinned_ || !(tooMany || tooBig || tooOld))
+            continue;
+        bytes -= entry.storedSize();
+        removeEntry(i);
+        evicted++;
     }
+    return evicted;
+}
+
+bool
+Clipboard::materializeRefs(const std::string &page)
+{
+    bool found = false;
+    for (ClipboardEntry &entry : entries_)
+    {
+        if (entry.refPage_ != page)
+            continue;
+        loadPayload(entry);
+        entry.refPage_.clear();
+        entry.refId_ = 0;
+        appendPayloads(entry);
+        found = true;
+    }
+    if (!found)
+        return false;
+    // The meta records change as well, rewrite them all at once
+    payloadLog_.flush();
+    rewriteIndex();
+    return true;
 }
 
 void
-Clipboard::restore(const size_t index)
+Clipboard::removePage()
 {
-    if (index == 0 || index >= entries_.size())
+    std::error_code ec;
+    fs::remove(indexLog_.path(), ec);
+    fs::remove(payloadLog_.path(), ec);
+    fs::remove(searchLog_.path(), ec);
+    blobs_.collect(pageName(), {});
+}
+
+void
+Clipboard::rebuildHashIndex()
+{
+    // Oldest first, so the most recent of duplicates (legacy pages) wins
+    hashIndex_.clear();
+    for (auto it = entries_.rbegin(); it != entries_.rend(); it++)
     {
-        std::cout << "Nothing to restore" << std::endl;
+        hashIndex_.insert_or_assign(it->hash_, it->id_);
+        // Copying it again should not need sniffing
+        if (!it->mime_.empty())
+            rememberMimeType(it->hash_, it->mime_);
+    }
+}
+
+void
+Clipboard::addToIndex(DedupIndex &index) const
+{
+    const std::string page = pageName();
+    for (auto it = entries_.rbegin(); it != entries_.rend(); it++)
+    {
+        if (it->refPage_.empty())
+            index.add(it->hash_, EntryRef{page, it->id_});
+        else
+            index.add(it->hash_, EntryRef{it->refPage_, it->refId_});
+    }
+}
+
+uint64_t
+Clipboard::appendData(const uint64_t id, const uint16_t part,
+        const std::span<const char> data, const std::string &mime)
+{
+    // Compressed first, sealed data does not compress anymore
+    const std::vector<char> compressed = codec_.compress(data, mime);
+    const std::span<const char> stored = compressed.empty() ? data :
+        std::span<const char>{compressed};
+    const uint8_t flags = compressed.empty() ? 0 : recordCompressed;
+
+    if (notSecure_)
+        return payloadLog_.append(RecordType::data, id, flags, stored.data(),
+                stored.size(), part);
+    const std::vector<char> sealed = sessionKey().seal(stored.data(),
+            stored.size(), entryPart(id, true, part));
+    return payloadLog_.append(RecordType::data, id, flags | recordSealed,
+            sealed.data(), sealed.size(), part);
+}
+
+void
+Clipboard::appendDictionaryRecord()
+{
+    const std::vector<char> &dictionary = codec_.dictionary();
+    if (notSecure_)
+    {
+        indexLog_.append(RecordType::dictionary, codec_.dictionaryId(), 0,
+                dictionary.data(), dictionary.size());
         return;
     }
-    const ClipboardEntry entry = entries_[index];
-    // Erase and write before copying the ClipboardEntry
-    // makes sure the file is written, before wl-paste invokes wlclipmgr again
-    entries_.erase(std::next(entries_.begin(), index));
-    writePage();
+    // Made of the entries, so just as secret
+    const std::vector<char> sealed = sessionKey().seal(dictionary.data(),
+            dictionary.size(), entryPart(codec_.dictionaryId(), false,
+                DICTIONARY_PART));
+    indexLog_.append(RecordType::dictionary, codec_.dictionaryId(),
+            recordSealed, sealed.data(), sealed.size());
+}
+
+// Trains the dictionary for text entries, once the page has enough text.
+// Entries stored before keep being compressed without it. A failed
+// attempt is kept in the index, so not every store tries again.
+void
+Clipboard::trainDictionary()
+{
+    if (codec_.hasDictionary())
+        return;
 
-    if (entry.size_ > MIN_SIZE_COPY_VIA_FILE || !entry.isPrintable())
+    size_t textEntries = 0;
+    size_t textBytes = 0;
+    for (const ClipboardEntry &entry : entries_)
     {
-        try
-        {
-            std::ofstream tmpFile{tmpFilePath_,
-                std::ios::out | std::ios::binary};
-            tmpFile << entry;
-            tmpFile.close();
-        }
-        catch (const std::exception &err)
+        if (!entry.refPage_.empty() || !entry.blob_.empty() ||
+                !PageCodec::usesDictionary(entry.mime_))
+            continue;
+        textEntries++;
+        textBytes += entry.size_;
+    }
+    if (textEntries < CODEC_DICT_MIN_SAMPLES ||
+            textBytes < CODEC_DICT_MIN_BYTES ||
+            textEntries < dictionaryTriedAt_ * CODEC_DICT_RETRY_GROWTH)
+        return;
+
+    TraceSpan span{"trainDictionary"};
+    std::vector<std::span<const char>> samples;
+    size_t sampleBytes = 0;
+    for (ClipboardEntry &entry : entries_)
+    {
+        if (sampleBytes >= CODEC_DICT_MAX_BYTES)
+            break;
+        if (!entry.refPage_.empty() || !entry.blob_.empty() ||
+                !PageCodec::usesDictionary(entry.mime_))
+            continue;
+        samples.push_back(loadPayload(entry).data());
+        sampleBytes += entry.size_;
+    }
+
+    std::vector<char> dictionary = PageCodec::trainDictionary(samples);
+    if (dictionary.empty())
+    {
+        if (dictionaryTriedAt_ != 0)
+            indexLog_.addGarbage(sizeof(RecordHeader));
+        dictionaryTriedAt_ = textEntries;
+        indexLog_.append(RecordType::dictionary, dictionaryTriedAt_, 0, NULL,
+                0);
+        return;
+    }
+    codec_.setDictionary(std::move(dictionary));
+    appendDictionaryRecord();
+}
+
+void
+Clipboard::appendTrigrams(const ClipboardEntry &entry)
+{
+    if (!entry.isPrintable())
+        return;
+    if (!searchAttached_)
+    {
+        searchLog_.attach();
+        searchAttached_ = true;
+    }
+
+    bool truncated;
+    std::vector<Trigram> trigrams = extractTrigrams(entry.data(), truncated);
+    const char *data = reinterpret_cast<const char *>(trigrams.data());
+    const size_t size = trigrams.size() * sizeof(Trigram);
+    const uint8_t flags = truncated ? recordTruncated : 0;
+    uint64_t offset;
+    if (notSecure_)
+        offset = searchLog_.append(RecordType::trigrams, entry.id_, flags,
+                data, size);
+    else
+    {
+        // Says what the text is about, just as secret
+        const std::vector<char> sealed = sessionKey().seal(data, size,
+                entryPart(entry.id_, false, TRIGRAMS_PART));
+        offset = searchLog_.append(RecordType::trigrams, entry.id_,
+                flags | recordSealed, sealed.data(), sealed.size());
+    }
+    if (searchLoaded_)
+        searchIndex_.insert_or_assign(entry.id_,
+                IndexedText{std::move(trigrams), truncated, offset});
+}
+
+// Reads the search log and indexes the text entries, that are not in it
+// yet (stored by older versions, or the log got lost).
+void
+Clipboard::loadSearchIndex()
+{
+    if (searchLoaded_)
+        return;
+    TraceSpan span{"loadSearchIndex"};
+    // Two searches could catch up on the same entries otherwise
+    const PageLock lock{pagePath_};
+    searchIndex_.clear();
+    if (searchLog_.exists()) try
+    {
+        searchLog_.load([this](const LogRecord &record)
         {
-            std::cerr << "Failed to write entry to tmpfile." << std::endl;
-            return;
-        }
-        if (std::system(("wl-copy < " + tmpFilePath_.string()).c_str()) != 0)
+            const RecordHeader &header = record.header_;
+            if (header.type_ != RecordType::trigrams)
+                return;
+            std::vector<char> res;
+            if (header.flags_ & recordSealed)
+                res = sessionKey().open(record.payload_, header.size_,
+                        entryPart(header.id_, false, TRIGRAMS_PART));
+            else
+                res.assign(record.payload_, record.payload_ + header.size_);
+
+            std::vector<Trigram> trigrams(res.size() / sizeof(Trigram));
+            std::memcpy(trigrams.data(), res.data(),
+                    trigrams.size() * sizeof(Trigram));
+            searchIndex_.insert_or_assign(header.id_, IndexedText{
+                    std::move(trigrams),
+                    (header.flags_ & recordTruncated) != 0, record.offset_});
+        });
+    }
+    catch (const std::runtime_error &err)
+    {
+        // Nothing lost, it just has to be built again
+        std::cerr << "Rebuilding search index of " << pageName() << ": "
+            << err.what() << std::endl;
+        searchIndex_.clear();
+        searchLog_.reset();
+        fs::remove(searchLog_.path());
+    }
+    searchAttached_ = true;
+    searchLoaded_ = true;
+
+    std::unordered_set<uint64_t> live;
+    bool added = false;
+    for (ClipboardEntry &entry : entries_)
+    {
+        if (!entry.isPrintable())
+            continue;
+        live.insert(entry.id_);
+        if (searchIndex_.contains(entry.id_))
+            continue;
+        appendTrigrams(loadPayload(entry));
+        added = true;
+    }
+    if (added)
+        searchLog_.flush();
+
+    // Removed entries, compact once they make up a good part of the log
+    std::vector<std::pair<uint64_t, uint64_t>> keep;
+    for (auto it = searchIndex_.begin(); it != searchIndex_.end();)
+    {
+        if (live.contains(it->first))
         {
-            std::cerr << "Copy file command failed:" << std::endl;
-            std::cerr << "\twl-copy < " << tmpFilePath_.string() << std::endl;
+            keep.push_back({it->second.offset_, it->first});
+            it++;
+            continue;
         }
+        searchLog_.addGarbage(sizeof(RecordHeader) +
+                it->second.trigrams_.size() * sizeof(Trigram));
+        it = searchIndex_.erase(it);
+    }
+    if (!searchLog_.needsCompaction())
+        return;
+    std::sort(keep.begin(), keep.end());
+    std::vector<uint64_t> offsets;
+    for (const auto &[offset, id] : keep)
+        offsets.push_back(offset);
+    const std::vector<uint64_t> newOffsets = searchLog_.compact(offsets);
+    for (size_t i = 0; i < keep.size(); i++)
+        searchIndex_.at(keep[i].second).offset_ = newOffsets[i];
+}
+
+std::vector<size_t>
+Clipboard::search(const SearchQuery &query)
+{
+    loadSearchIndex();
+    TraceSpan span{"search"};
+    std::vector<size_t> res;
+    for (size_t i = 0; i < entries_.size(); i++)
+    {
+        ClipboardEntry &entry = entries_[i];
+        if (!entry.isPrintable())
+            continue;
+        const auto indexed = searchIndex_.find(entry.id_);
+        if (indexed != searchIndex_.end() && !query.mightMatch(
+                    indexed->second.trigrams_, indexed->second.truncated_))
+            continue;
+        if (query.matches(loadPayload(entry).data()))
+            res.push_back(i);
+    }
+    return res;
+}
+
+void
+Clipboard::appendPayloads(ClipboardEntry &entry)
+{
+    attachPayloadLog();
+    if (entry.size_ >= BLOB_MIN_SIZE)
+    {
+        entry.blob_ = BlobStore::blobName(pageName(), entry.hash_, blobKey());
+        blobs_.write(entry.blob_, entry.data(), blobKey());
+        entry.payloadOffset_ = 0;
     }
     else
     {
-        std::cout << "hello" << std::endl;
-        const std::string prefix = "wl-copy \"";
-        std::vector<char> command(prefix.begin(), prefix.end());
+        entry.blob_.clear();
+        entry.payloadOffset_ = appendData(entry.id_, 0, entry.data(),
+                entry.mime_);
+    }
+    for (size_t i = 0; i < entry.alternatives_.size(); i++)
+    {
+        EntryAlternative &alternative = entry.alternatives_[i];
+        alternative.payloadOffset_ = appendData(entry.id_, i + 1,
+                alternative.data_.bytes(), alternative.mime_);
+    }
+}
+
+void
+Clipboard::appendEntry(ClipboardEntry &entry)
+{
+    appendPayloads(entry);
+    appendMetaRecord(entry);
+}
 
-        command.insert(command.end(), entry.buffer_.begin(),
-                entry.buffer_.end());
+void
+Clipboard::loadIndexRecord(const LogRecord &record)
+{
+    const RecordHeader &header = record.header_;
+    if (header.id_ >= nextId_)
+        nextId_ = header.id_ + 1;
 
-        command.push_back('\"');
-        command.push_back('\0');
+    const auto findEntry = [&]()
+    {
+        return std::find_if(entries_.begin(), entries_.end(),
+            [&](const ClipboardEntry &entry) { return entry.id_ == header.id_; });
+    };
 
-        if (std::system(command.data()) != 0)
+    switch (header.type_)
+    {
+        case RecordType::meta:
         {
-            std::cerr << "Copy command failed:" << std::endl;
-            std::cerr << '\t' << command.data() << std::endl;
+            EntryMeta meta;
+            if (header.flags_ & recordSealed)
+            {
+                const std::vector<char> res = sessionKey().open(
+                        record.payload_, header.size_,
+                        entryPart(header.id_, false));
+                msgpack::unpack(res.data(), res.size()).get().convert(meta);
+            }
+            else
+                msgpack::unpack(record.payload_, header.size_).get()
+                    .convert(meta);
+
+            ClipboardEntry entry;
+            entry.size_ = meta.size_;
+            entry.mime_ = MimeType{meta.mime_};
+            entry.hash_ = hashFromString(meta.hash_);
+            entry.timestamp_ = meta.timestamp_;
+            entry.preview_ = meta.previewRendered_ ?
+                std::move(meta.preview_) :
+                renderPreview(entry.mime_, entry.size_, meta.preview_);
+            entry.payloadOffset_ = meta.payloadOffset_;
+            entry.refPage_ = std::move(meta.refPage_);
+            entry.refId_ = meta.refId_;
+            entry.alternatives_ = std::move(meta.alternatives_);
+            entry.pinned_ = meta.pinned_;
+            entry.blob_ = std::move(meta.blob_);
+            entry.id_ = header.id_;
+            entry.loaded_ = false;
+            entries_.push_front(std::move(entry));
+            break;
+        }
+        case RecordType::sessionKey:
+            if (!wrappedSessionKey_.empty())
+            {
+                indexLog_.addGarbage(sizeof(RecordHeader) + header.size_);
+                break;
+            }
+            wrappedSessionKey_.assign(record.payload_,
+                    record.payload_ + header.size_);
+            break;
+        case RecordType::dictionary:
+        {
+            // Only one per page
+            if (codec_.hasDictionary())
+            {
+                indexLog_.addGarbage(sizeof(RecordHeader) + header.size_);
+                break;
+            }
+            // Failed training, the last attempt is what counts
+            if (header.size_ == 0)
+            {
+                if (dictionaryTriedAt_ != 0)
+                    indexLog_.addGarbage(sizeof(RecordHeader));
+                dictionaryTriedAt_ = header.id_;
+                break;
+            }
+            if (header.flags_ & recordSealed)
+                codec_.setDictionary(sessionKey().open(record.payload_,
+                            header.size_, entryPart(header.id_, false,
+                                DICTIONARY_PART)));
+            else
+                codec_.setDictionary({record.payload_,
+                        record.payload_ + header.size_});
+            break;
         }
+        case RecordType::promote:
+        {
+            indexLog_.addGarbage(sizeof(RecordHeader));
+            const auto it = findEntry();
+            if (it == entries_.end())
+                break;
+            ClipboardEntry entry = std::move(*it);
+            entries_.erase(it);
+            entries_.push_front(std::move(entry));
+            break;
+        }
+        case RecordType::pin:
+        case RecordType::unpin:
+        {
+            indexLog_.addGarbage(sizeof(RecordHeader));
+            const auto it = findEntry();
+            if (it != entries_.end())
+                it->pinned_ = header.type_ == RecordType::pin;
+            break;
+        }
+        case RecordType::remove:
+        {
+            indexLog_.addGarbage(sizeof(RecordHeader));
+            const auto it = findEntry();
+            if (it == entries_.end())
+                break;
+            payloadLog_.addGarbage(it->payloadSize());
+            if (!it->blob_.empty())
+                blobsDropped_ = true;
+            entries_.erase(it);
+            break;
+        }
+        default:
+            // Unknown record from a newer version, nothing we can do with it
+            indexLog_.addGarbage(sizeof(RecordHeader) + header.size_);
+            break;
     }
 }
 
-void
-Clipboard::unpackEntries(const std::vector<char> &data)
+ClipboardEntry &
+Clipboard::loadPayload(ClipboardEntry &entry, const bool blobData)
 {
-    if (data.empty())
-        return;
+    if (entry.loaded_)
+        return entry;
+    if (!entry.refPage_.empty())
+        return loadReferenced(entry);
 
-    msgpack::object_handle oh = msgpack::unpack(data.data(), data.size());
-    msgpack::object obj = oh.get();
+    TraceSpan span{"loadPayload"};
+    attachPayloadLog();
+    const auto isDataOf = [&](const uint64_t offset, const uint16_t part)
+    {
+        if (offset + sizeof(RecordHeader) > payloadLog_.size())
+            return false;
+        const RecordHeader header =
+            payloadLog_.readRecord(offset, false).header_;
+        return header.type_ == RecordType::data && header.id_ == entry.id_ &&
+            header.part_ == part;
+    };
+    const bool isBlob = !entry.blob_.empty();
+    const auto isComplete = [&]()
+    {
+        if (!isBlob && !isDataOf(entry.payloadOffset_, 0))
+            return false;
+        for (size_t i = 0; i < entry.alternatives_.size(); i++)
+        {
+            if (!isDataOf(entry.alternatives_[i].payloadOffset_, i + 1))
+                return false;
+        }
+        return true;
+    };
+    if (!isComplete())
+    {
+        // Index and payload log are out of sync (crash while compacting)
+        relocatePayloads();
+        if (!isComplete())
+            throw std::runtime_error("The data of this entry is missing!");
+    }
 
-    obj.convert(entries_);
-};
+    for (size_t i = 0; i < entry.alternatives_.size(); i++)
+    {
+        EntryAlternative &alternative = entry.alternatives_[i];
+        alternative.data_ = readData(entry.id_, i + 1,
+                alternative.payloadOffset_);
+    }
+    if (!isBlob)
+        entry.data_ = readData(entry.id_, 0, entry.payloadOffset_);
+    else if (blobData || notSecure_)
+    {
+        // Plain blobs are only mapped, so they are always loaded
+        entry.data_ = blobs_.read(entry.blob_, blobKey());
+        if (entry.data_.bytes().size() != entry.size_)
+            throw std::runtime_error("The blob of this entry is damaged!");
+    }
+    else
+        return entry;
+    entry.loaded_ = true;
+    return entry;
+}
 
-void
-Clipboard::encryptWritePage(const msgpack::sbuffer &sbuf) const noexcept
+EntryData
+Clipboard::readData(const uint64_t id, const uint16_t part,
+        const uint64_t offset)
 {
-    const GpgMEInterface gpgInterface{gpgUserName_};
-    std::vector<char> res = gpgInterface.encrypt(sbuf.data(), sbuf.size());
+    const LogRecord record = payloadLog_.readRecord(offset);
+    const uint8_t flags = record.header_.flags_;
+    std::span<const char> stored{record.payload_, record.header_.size_};
+    if (flags & recordSealed)
+    {
+        const size_t size = SessionKey::openedSize(stored.size());
+        const uint64_t associated = entryPart(id, true, part);
+        if (!(flags & recordCompressed))
+        {
+            ArenaBuffer res = arena_.allocate(size);
+            sessionKey().open(stored.data(), stored.size(), associated,
+                    res.data_);
+            return {{}, res.data_, std::move(res.owner_)};
+        }
+        scratch_.resize(size);
+        sessionKey().open(stored.data(), stored.size(), associated, scratch_);
+        stored = scratch_;
+    }
+    if (flags & recordCompressed)
+    {
+        ArenaBuffer res = arena_.allocate(PageCodec::decompressedSize(stored));
+        codec_.decompress(stored, res.data_);
+        return {{}, res.data_, std::move(res.owner_)};
+    }
+    return {{}, stored, payloadLog_.region()};
+}
 
-    std::ofstream outFile{pagePath_.string()+".gpg",
-        std::ios::out | std::ios::binary};
+ClipboardEntry &
+Clipboard::loadReferenced(ClipboardEntry &entry)
+{
+    Clipboard refPage{pagePath_.parent_path() / entry.refPage_, gpgUserName_,
+        notSecure_};
+    refPage.loadPage();
+    const auto it = std::find_if(refPage.entries_.begin(),
+            refPage.entries_.end(),
+            [&](const ClipboardEntry &candidate)
+            {
+                return candidate.id_ == entry.refId_ &&
+                    candidate.refPage_.empty();
+            });
+    if (it == refPage.entries_.end() || it->hash_ != entry.hash_)
+        throw std::runtime_error("The data of this entry was in page " +
+                entry.refPage_ + ", which does not have it anymore!");
+
+    ClipboardEntry &referenced = refPage.loadPayload(*it);
+    entry.data_ = std::move(referenced.data_);
+    entry.alternatives_ = std::move(referenced.alternatives_);
+    entry.loaded_ = true;
+    return entry;
+}
 
-    outFile.write(res.data(), res.size());
-    outFile.close();
+void
+Clipboard::relocatePayloads()
+{
+    std::map<std::pair<uint64_t, uint16_t>, uint64_t> offsets;
+    payloadLog_.scan([&](const LogRecord &record)
+    {
+        const RecordHeader &header = record.header_;
+        if (header.type_ == RecordType::data)
+            offsets[{header.id_, header.part_}] = record.offset_;
+    });
+    const auto relocate = [&](const uint64_t id, const uint16_t part,
+            uint64_t &payloadOffset)
+    {
+        const auto it = offsets.find({id, part});
+        if (it != offsets.end())
+            payloadOffset = it->second;
+    };
+    for (ClipboardEntry &entry : entries_)
+    {
+        relocate(entry.id_, 0, entry.payloadOffset_);
+        for (size_t i = 0; i < entry.alternatives_.size(); i++)
+            relocate(entry.id_, i + 1, entry.alternatives_[i].payloadOffset_);
+    }
+}
 
-    if (fs::exists(pagePath_))
-        fs::remove(pagePath_);
+void
+Clipboard::rewriteIndex()
+{
+    // Session key first and entries oldest first, so replaying the index
+    // yields the same page
+    indexLog_.reset();
+    if (!wrappedSessionKey_.empty())
+        indexLog_.append(RecordType::sessionKey, 0, recordGpgEncrypted,
+                wrappedSessionKey_.data(), wrappedSessionKey_.size());
+    if (codec_.hasDictionary())
+        appendDictionaryRecord();
+    else if (dictionaryTriedAt_ != 0)
+        indexLog_.append(RecordType::dictionary, dictionaryTriedAt_, 0, NULL,
+                0);
+    for (auto it = entries_.rbegin(); it != entries_.rend(); it++)
+        appendMetaRecord(*it);
+    indexLog_.flush();
+    lastSync_ = fs::last_write_time(indexLog_.path());
 }
 
 void
-Clipboard::decryptLoadPage(const std::vector<char> &data) noexcept
+Clipboard::rewritePage()
 {
-    const GpgMEInterface gpgInterface{gpgUserName_};
-    std::vector<char> res = gpgInterface.decrypt(data.data(), data.size());
+    for (ClipboardEntry &entry : entries_)
+    {
+        if (entry.refPage_.empty())
+            loadPayload(entry);
+    }
 
-    unpackEntries(res);
+    payloadLog_.reset();
+    payloadAttached_ = true;
+    for (auto it = entries_.rbegin(); it != entries_.rend(); it++)
+    {
+        ClipboardEntry &entry = *it;
+        if (entry.refPage_.empty())
+            appendPayloads(entry);
+    }
+    // Data first, the index is what makes the page
+    payloadLog_.flush();
+    rewriteIndex();
 }
 
 void
-Clipboard::writePage() const
+Clipboard::writePage()
 {
+    TraceSpan span{"writePage"};
     if (entries_.empty())
     {
         std::cout << "Nothing to write!" << std::endl;
         return;
     }
-    msgpack::sbuffer sbuf;
-    msgpack::pack(sbuf, entries_);
+    // Data first, the index is what makes the page
+    payloadLog_.flush();
+    indexLog_.flush();
+    lastSync_ = fs::last_write_time(indexLog_.path());
+    searchLog_.flush();
+}
 
-    if (notSecure_)
+bool
+Clipboard::needsCompaction() const noexcept
+{
+    return indexLog_.needsCompaction() || payloadLog_.needsCompaction() ||
+        blobsDropped_;
+}
+
+void
+Clipboard::compactPage()
+{
+    TraceSpan span{"compactPage"};
+    payloadLog_.flush();
+    indexLog_.flush();
+
+    if (payloadLog_.needsCompaction())
     {
-        std::ofstream pageFile{pagePath_, std::ios::out | std::ios::binary};
-        pageFile.write(sbuf.data(), sbuf.size());
-        pageFile.close();
+        attachPayloadLog();
+        // Every data record of the page, oldest entry first
+        std::vector<uint64_t *> payloadOffsets;
+        for (auto it = entries_.rbegin(); it != entries_.rend(); it++)
+        {
+            if (!it->refPage_.empty())
+                continue;
+            if (it->blob_.empty())
+                payloadOffsets.push_back(&it->payloadOffset_);
+            for (EntryAlternative &alternative : it->alternatives_)
+                payloadOffsets.push_back(&alternative.payloadOffset_);
+        }
 
-        if (fs::exists(pagePath_.string() + ".gpg"))
-            fs::remove(pagePath_.string() + ".gpg");
+        std::vector<uint64_t> offsets;
+        offsets.reserve(payloadOffsets.size());
+        for (const uint64_t *offset : payloadOffsets)
+            offsets.push_back(*offset);
+        const std::vector<uint64_t> newOffsets = payloadLog_.compact(offsets);
+        for (size_t i = 0; i < payloadOffsets.size(); i++)
+            *payloadOffsets[i] = newOffsets[i];
+    }
+    rewriteIndex();
 
-        return;
+    // Only once the index does not know the removed entries anymore
+    if (blobsDropped_)
+    {
+        std::unordered_set<std::string> live;
+        for (const ClipboardEntry &entry : entries_)
+        {
+            if (!entry.blob_.empty())
+                live.insert(entry.blob_);
+        }
+        blobs_.collect(pageName(), live);
+        blobsDropped_ = false;
     }
+}
 
-    encryptWritePage(sbuf);
+bool
+Clipboard::changedOnDisk() const
+{
+    // search appends to (or compacts) the search log on its own
+    if ((payloadAttached_ && payloadLog_.changedOnDisk()) ||
+            (searchAttached_ && searchLog_.changedOnDisk()))
+        return true;
+    std::error_code ec;
+    const auto writeTime = fs::last_write_time(indexLog_.path(), ec);
+    if (ec)
+        return false;
+    return writeTime != lastSync_;
+}
+
+void
+Clipboard::reloadPage()
+{
+    const std::vector<char> oldWrappedKey = std::move(wrappedSessionKey_);
+    wrappedSessionKey_.clear();
+    entries_.clear();
+    hashIndex_.clear();
+    codec_.reset();
+    dictionaryTriedAt_ = 0;
+    indexLog_.reset();
+    payloadLog_.reset();
+    payloadAttached_ = false;
+    searchLog_.reset();
+    searchAttached_ = false;
+    searchLoaded_ = false;
+    searchIndex_.clear();
+    loadPage();
+    // Keep the unwrapped key, unless the page got a new one
+    if (wrappedSessionKey_ != oldWrappedKey)
+        sessionKey_.reset();
 }
 
 void
 Clipboard::loadPage()
 {
+    TraceSpan span{"loadPage"};
+    if (indexLog_.exists())
+    {
+        loadIndex();
+        return;
+    }
+
+    // Migrating writes the page, also when we only read it. Another
+    // process could be migrating or storing to it meanwhile.
+    const PageLock lock{pagePath_};
+    if (indexLog_.exists())
+    {
+        loadIndex();
+        return;
+    }
+    const fs::path legacyPath = loadLegacyPage();
+    if (legacyPath.empty())
+        return;
+    rebuildHashIndex();
+    rewritePage();
+    fs::remove(legacyPath);
+}
+
+void
+Clipboard::loadIndex()
+{
+    indexLog_.load([this](const LogRecord &record)
+    {
+        loadIndexRecord(record);
+    });
+    lastSync_ = fs::last_write_time(indexLog_.path());
+    rebuildHashIndex();
+
+    // Left over from an interrupted migration
+    const fs::path logV1Path{pagePath_.string() + ".log"};
+    if (fs::exists(logV1Path))
+    {
+        const PageLock lock{pagePath_};
+        std::error_code ec;
+        fs::remove(logV1Path, ec);
+    }
+}
+
+/*
+    Version 1 logs: <page>.log with whole entry records, promote, remove
+    and sessionKey records. Entries are decoded right away, they get
+    migrated to the current format anyway.
+*/
+void
+Clipboard::loadLogV1Record(const LogRecord &record)
+{
+    const RecordHeader &header = record.header_;
+    if (header.id_ >= nextId_)
+        nextId_ = header.id_ + 1;
+
+    if (header.type_ == RecordType::sessionKey)
+    {
+        if (wrappedSessionKey_.empty())
+            wrappedSessionKey_.assign(record.payload_,
+                    record.payload_ + header.size_);
+        return;
+    }
+    if (header.type_ != RecordType::entry)
+    {
+        // promote and remove look the same in both versions
+        loadIndexRecord(record);
+        return;
+    }
+
+    ClipboardEntry entry;
+    if (header.flags_ & recordSplit)
+    {
+        // [u32 metaSize][meta (size, mime, preview)][data]
+        uint32_t metaSize;
+        if (header.size_ < sizeof(metaSize))
+            throw std::runtime_error("Damaged entry record in the page!");
+        std::memcpy(&metaSize, record.payload_, sizeof(metaSize));
+        if (sizeof(metaSize) + metaSize > header.size_)
+            throw std::runtime_error("Damaged entry record in the page!");
+        const char *meta = record.payload_ + sizeof(metaSize);
+        const char *data = meta + metaSize;
+        const size_t dataSize = header.size_ - sizeof(metaSize) - metaSize;
+
+        msgpack::type::tuple<size_t, std::string, std::string> metaTuple;
+        if (header.flags_ & recordSealed)
+        {
+            const std::vector<char> res = sessionKey().open(meta, metaSize,
+                    entryPart(header.id_, false));
+            msgpack::unpack(res.data(), res.size()).get().convert(metaTuple);
+            entry.data_.buffer_ = sessionKey().open(data, dataSize,
+                    entryPart(header.id_, true));
+        }
+        else
+        {
+            msgpack::unpack(meta, metaSize).get().convert(metaTuple);
+            entry.data_.buffer_.assign(data, data + dataSize);
+        }
+        entry.size_ = metaTuple.get<0>();
+        entry.mime_ = MimeType{metaTuple.get<1>()};
+        entry.preview_ = renderPreview(entry.mime_, entry.size_,
+                metaTuple.get<2>());
+    }
+    else if (header.flags_ & recordGpgEncrypted)
+    {
+        const std::vector<char> res = gpgInterface().decrypt(
+                record.payload_, header.size_);
+        LegacyEntry legacy;
+        msgpack::unpack(res.data(), res.size()).get().convert(legacy);
+        entry = ClipboardEntry{std::move(legacy.buffer_), legacy.size_,
+            legacy.mime_};
+        entry.setPreview();
+    }
+    else
+    {
+        LegacyEntry legacy;
+        msgpack::unpack(record.payload_, header.size_).get().convert(legacy);
+        entry = ClipboardEntry{std::move(legacy.buffer_), legacy.size_,
+            legacy.mime_};
+        entry.setPreview();
+    }
+    entry.setHash();
+    entry.id_ = header.id_;
+    entries_.push_front(std::move(entry));
+}
+
+// Loads a page written by an older version into entries_.
+// Returns the file to remove, once the page is migrated.
+fs::path
+Clipboard::loadLegacyPage()
+{
+    const fs::path logV1Path{pagePath_.string() + ".log"};
+    if (fs::exists(logV1Path))
+    {
+        PageLog logV1{logV1Path};
+        logV1.load([this](const LogRecord &record)
+        {
+            loadLogV1Record(record);
+        });
+        if (logV1.version() != 1)
+            throw std::runtime_error(logV1Path.string() +
+                    " has an unexpected version!");
+        const uint64_t timestamp = fileTimestamp(logV1Path);
+        for (ClipboardEntry &entry : entries_)
+            entry.timestamp_ = timestamp;
+        return logV1Path;
+    }
+
+    // Pages written before the log format are a single msgpack'ed deque,
+    // either plain or encrypted as a whole.
     fs::path pageFilePath{pagePath_.string() + ".gpg"};
     bool isEncrypted = true;
     if (!fs::exists(pageFilePath))
     {
         if (!fs::exists(pagePath_))
-            return;
+            return {};
         pageFilePath = fs::path{pagePath_};
         isEncrypted = false;
     }
 
-    std::ifstream pageFile{pageFilePath, std::ios::in | std::ios::binary};
     size_t pageSize;
     try
     {
@@ -193,96 +1302,84 @@ Clipboard::loadPage()
     } catch (const fs::filesystem_error &err)
     {
         std::cerr << err.what() << std::endl;
-        return;
+        return {};
     }
     if (pageSize == 0)
-        return;
+        return {};
 
-    std::vector<char> readBuff(pageSize);
-    pageFile.read(readBuff.data(), pageSize);
-    pageFile.close();
+    // Mapped, so the only copy in memory is the decrypted page
+    {
+        const MappedFile pageMap{pageFilePath};
+        if (isEncrypted)
+            decryptLoadPage(pageMap.data(), pageMap.size());
+        else
+            unpackEntries(pageMap.data(), pageMap.size());
+    }
 
-    if (isEncrypted)
-        decryptLoadPage(readBuff);
-    else
-        unpackEntries(readBuff);
+    const uint64_t timestamp = fileTimestamp(pageFilePath);
+    for (auto it = entries_.rbegin(); it != entries_.rend(); it++)
+    {
+        it->setPreview();
+        it->setHash();
+        it->timestamp_ = timestamp;
+        it->id_ = nextId_++;
+    }
+    return pageFilePath;
 }
 
 const ClipboardEntry &
 ClipboardEntry::setMimeType()
 {
-    int res_prio;
-    const char *res = xdg_mime_get_mime_type_for_data(buffer_.data(),
-            size_, &res_prio);
+    mime_ = sniffMimeType(hash_, data());
+    return *this;
+}
+
+const ClipboardEntry &
+ClipboardEntry::setPreview()
+{
+    preview_ = renderPreview(mime_, size_, data());
+    return *this;
+}
 
-    mime_ = std::string{res};
+const ClipboardEntry &
+ClipboardEntry::setHash()
+{
+    hash_ = hashContent(data().data(), data().size());
     return *this;
 }
 
 bool ClipboardEntry::isPrintable() const noexcept
 {
-    static const std::string textMime = "text";
-    if (mime_.empty() || mime_.size() < textMime.size())
-        return false;
-    if ("text" == mime_.substr(0, textMime.size() - 1))
-        return true;
-    return false;
+    return mime_.str().starts_with("text/");
+}
+
+std::vector<std::string>
+ClipboardEntry::mimeTypes() const
+{
+    if (mime_.empty())
+        return {"application/octet-stream"};
+    if (mime_ != "text/plain")
+        return {mime_.str()};
+    // What text gets asked for by wayland and xwayland clients
+    return {"text/plain;charset=utf-8", "text/plain", "UTF8_STRING", "STRING",
+        "TEXT"};
 }
 
 bool
 ClipboardEntry::operator==(const ClipboardEntry &other) const noexcept
 {
-    if (size_ != other.size_)
-        return false;
-    if (buffer_ != other.buffer_)
+    // The data of either might not be loaded, the hash always is
+    if (hash_ != other.hash_ || size_ != other.size_)
         return false;
+    if (loaded_ && other.loaded_)
+        return std::ranges::equal(data(), other.data());
     return true;
 }
 
 std::ostream &
 operator<<(std::ostream &os, const ClipboardEntry &obj)
 {
-    static const std::unordered_map<char,std::string> substitute
-    {
-        {'\n', "\\n"}, {'\r', "\\r"}, {'\r', "\\r"}
-    };
-
-    if (!obj.mime_.empty() && obj.mime_ != "text/plain")
-    {
-        os << "mime: [" << obj.mime_ << "], size: " << obj.size_;
-        return os;
-    }
-
-    size_t outSize = obj.size_;
-    std::string suffix;
-    if (outSize > OUTPUT_LINE_TRUNCATE_AFTER)
-    {
-        std::stringstream ss;
-        ss << "... (+" << outSize << ")";
-        suffix = ss.str();
-        outSize = OUTPUT_LINE_TRUNCATE_AFTER - suffix.size();
-    }
-
-    std::vector<char> outBuffer(obj.buffer_.begin(),
-        obj.buffer_.begin() + outSize);
-
-    for (const char c : outBuffer)
-    {
-        auto it = substitute.find(c);
-        if (it != substitute.end())
-            os << it->second;
-        else if (std::isprint(c))
-            os << c;
-        else
-            os << "█";
-    }
-
-    return os << suffix;
-}
-
-std::ofstream &
-operator<<(std::ofstream &ofs, const ClipboardEntry &obj)
-{
-    ofs.write(obj.buffer_.data(), obj.buffer_.size());
-    return ofs;
+    if (obj.pinned_)
+        os << "[pinned] ";
+    return os << obj.preview_;
 }
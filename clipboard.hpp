@@ -4,74 +4,298 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <span>
+#include <memory>
 #include <deque>
+#include <functional>
+#include <unordered_map>
+#include <ctime>
 #include <filesystem>
 namespace fs = std::filesystem;
 
 #include <msgpack.hpp>
 
-#define MAX_SIZE_CLIPBOARD_ENTRY 0x1000000
-#define MIN_SIZE_COPY_VIA_FILE 0x100
-#define OUTPUT_LINE_TRUNCATE_AFTER 0x36
+#include "pagelog.hpp"
+#include "sessionkey.hpp"
+#include "contenthash.hpp"
+#include "dedupindex.hpp"
+#include "ingest.hpp"
+#include "codec.hpp"
+#include "searchindex.hpp"
+#include "retention.hpp"
+#include "blobstore.hpp"
+#include "listing.hpp"
+#include "arena.hpp"
+#include "mimesniff.hpp"
 
-class ClipboardEntry
+#define MAX_SIZE_CLIPBOARD_ENTRY 0x1000000 // default of the limit
+
+class GpgMEInterface;
+
+// Bytes of an entry (or alternative). Either in buffer_, or a view into
+// memory owner_ keeps alive: the mapped payload log (or blob) for plain
+// data, so loading it does not copy it, the PageArena for opened data.
+struct EntryData
 {
     std::vector<char> buffer_;
-    size_t size_;
+    std::span<const char> view_;
+    std::shared_ptr<const void> owner_;
+
+    std::span<const char> bytes() const noexcept
+    {
+        if (owner_)
+            return view_;
+        return buffer_;
+    }
+};
+
+// Another representation of the same copy, e.g. text/html next to text/plain
+struct EntryAlternative
+{
     std::string mime_;
+    size_t size_ = 0;
+    uint64_t payloadOffset_ = 0;
+    // Like the data of the entry, only there once it is loaded
+    EntryData data_;
+
+    MSGPACK_DEFINE(mime_, size_, payloadOffset_)
+};
+
+class ClipboardEntry
+{
+    EntryData data_;
+    size_t size_;
+    MimeType mime_;
+
+    // Kept in the page index
+    ContentHash hash_{};
+    uint64_t timestamp_ = 0;
+    // What it is listed as, see renderPreview
+    std::string preview_;
+    // Where the entry lives in the page
+    uint64_t id_ = 0;
+    uint64_t payloadOffset_ = 0;
+    std::vector<EntryAlternative> alternatives_;
+    // Set, if the data is stored by an entry of another page
+    std::string refPage_;
+    uint64_t refId_ = 0;
+    // Set, if the data is in a blob of the page, instead of the payload log
+    std::string blob_;
+    // data_ is only read from the payload log, when needed
+    bool loaded_ = true;
+    // Never evicted
+    bool pinned_ = false;
 
-    ClipboardEntry(const std::vector<char> &input, const size_t inputSize) :
-        buffer_{input}, size_{inputSize}
+    // Takes over the buffer, the data was hashed while reading it
+    explicit ClipboardEntry(Ingest &&selection) :
+        data_{std::move(selection.buffer_)}, size_{selection.size_},
+        hash_{selection.hasher_.finish()},
+        timestamp_{static_cast<uint64_t>(std::time(0))}
     {
+        data_.buffer_.resize(size_);
         setMimeType();
+        setPreview();
     }
+    // From a page before the page log
+    ClipboardEntry(std::vector<char> &&buffer, const size_t size,
+            const std::string_view mime) :
+        data_{std::move(buffer)}, size_{size}, mime_{mime}
+    {
+    }
+
+    // Bytes it takes up in its page, blob included
+    uint64_t storedSize() const noexcept;
+    // Bytes it takes up in the payload log of its page
+    uint64_t payloadSize() const noexcept;
 
     friend std::ostream &operator<<(std::ostream &os,
             const ClipboardEntry &obj);
-    friend std::ofstream &operator<<(std::ofstream &os,
-            const ClipboardEntry &obj);
     friend class Clipboard;
 
     public:
     ClipboardEntry() = default;
+    // Entries are only ever moved, copying their data would be a waste
+    ClipboardEntry(const ClipboardEntry &) = delete;
+    ClipboardEntry &operator=(const ClipboardEntry &) = delete;
+    ClipboardEntry(ClipboardEntry &&) = default;
+    ClipboardEntry &operator=(ClipboardEntry &&) = default;
 
     bool isPrintable() const noexcept;
+    bool pinned() const noexcept { return pinned_; }
+    size_t size() const noexcept { return size_; }
+    const std::string &mime() const noexcept { return mime_.str(); }
+    uint64_t timestamp() const noexcept { return timestamp_; }
+    const std::string &preview() const noexcept { return preview_; }
+    std::span<const char> data() const noexcept { return data_.bytes(); }
+    const std::vector<EntryAlternative> &alternatives() const noexcept
+    {
+        return alternatives_;
+    }
+    // What to offer the entry as, when it becomes the selection again
+    std::vector<std::string> mimeTypes() const;
 
     bool operator==(const ClipboardEntry &other) const noexcept;
     const ClipboardEntry &setMimeType();
-
-    MSGPACK_DEFINE(buffer_, size_, mime_)
+    const ClipboardEntry &setPreview();
+    const ClipboardEntry &setHash();
 };
 
 class Clipboard
 {
+    static inline size_t maxEntrySize_ = MAX_SIZE_CLIPBOARD_ENTRY;
     const fs::path pagePath_;
-    const fs::path tmpFilePath_;
     std::deque<ClipboardEntry> entries_;
+    PageLog indexLog_;
+    PageLog payloadLog_;
+    bool payloadAttached_ = false;
+    uint64_t nextId_ = 1;
 
     const std::string gpgUserName_;
     const bool notSecure_;
 
-    void encryptWritePage(const msgpack::sbuffer &sbuf) const noexcept;
-    void decryptLoadPage(const std::vector<char> &data) noexcept;
+    fs::file_time_type lastSync_{};
 
-    public:
-    Clipboard(const fs::path &pagePath, const fs::path &tmpFilePath,
-            const std::string &gpgUserName, bool notSecure) :
-        pagePath_{pagePath}, tmpFilePath_{tmpFilePath}, gpgUserName_{gpgUserName},
-        notSecure_{notSecure}
+    // Unwrapped on first use, the wrapped key is stored in the index.
+    std::unique_ptr<SessionKey> sessionKey_;
+    std::vector<char> wrappedSessionKey_;
+
+    // Compresses entries and holds the dictionary of the page
+    PageCodec codec_;
+    // Text entries of the page, when training the dictionary failed last
+    uint64_t dictionaryTriedAt_ = 0;
+
+    // Opened and decompressed entry data lives here
+    PageArena arena_;
+    // Compressed data is opened into it, before being decompressed
+    std::vector<char> scratch_;
+
+    // Large entries, only read when needed
+    const BlobStore blobs_;
+    // Removed entries left blobs behind, the next compaction drops them
+    bool blobsDropped_ = false;
+
+    // Trigrams of the text entries, only loaded for searching
+    struct IndexedText
     {
-    }
+        std::vector<Trigram> trigrams_;
+        bool truncated_;
+        uint64_t offset_; // of the record in the search log
+    };
+    PageLog searchLog_;
+    bool searchAttached_ = false;
+    bool searchLoaded_ = false;
+    std::unordered_map<uint64_t, IndexedText> searchIndex_;
+
+    // Content hash -> entry id, for the entries of this page
+    std::unordered_map<ContentHash, uint64_t, ContentHashHasher> hashIndex_;
+    // Entries of other pages, set by a resident Clipboard (daemon)
+    const DedupIndex *history_ = nullptr;
+    RetentionPolicy retention_;
+
+    const GpgMEInterface &gpgInterface() const;
+    const SessionKey &sessionKey();
+    // What blobs of the page are sealed with, null if they are not
+    const SessionKey *blobKey();
+
+    uint64_t appendData(const uint64_t id, const uint16_t part,
+            const std::span<const char> data, const std::string &mime);
+    void appendDictionaryRecord();
+    void trainDictionary();
+    void appendTrigrams(const ClipboardEntry &entry);
+    void loadSearchIndex();
+    void appendPayloads(ClipboardEntry &entry);
+    void appendEntry(ClipboardEntry &entry);
+    void appendMetaRecord(const ClipboardEntry &entry);
+    void promoteEntry(const size_t index);
+    void removeEntry(const size_t index);
+    void rebuildHashIndex();
+    void loadIndexRecord(const LogRecord &record);
+    // Sealed blobs are only opened, if blobData
+    ClipboardEntry &loadPayload(ClipboardEntry &entry,
+            const bool blobData = true);
+    ClipboardEntry &loadReferenced(ClipboardEntry &entry);
+    EntryData readData(const uint64_t id, const uint16_t part,
+            const uint64_t offset);
+    void attachPayloadLog();
+    void relocatePayloads();
+    void rewriteIndex();
+    void rewritePage();
+    void loadIndex();
 
-    ~Clipboard() = default;
+    // Pages written by older versions
+    void decryptLoadPage(const char *data, const size_t size) noexcept;
+    void loadLogV1Record(const LogRecord &record);
+    fs::path loadLegacyPage();
+
+    public:
+    Clipboard(const fs::path &pagePath, const std::string &gpgUserName,
+            bool notSecure);
+
+    ~Clipboard();
 
     void addEntry(const std::string &blockOption);
-    void listEntries(const size_t num);
-    void restore(const size_t index);
+    bool addEntry(Ingest &&selection, const std::string &blockOption,
+            std::vector<EntryAlternative> &&alternatives = {});
+    void listEntries(ListRenderer &renderer, const size_t num) const;
+    // Moves the entry at index to the front and returns it, loaded.
+    // The front of an older page is not the current selection, so it
+    // can be restored as well. Sealed blobs are left for dataWriter.
+    const ClipboardEntry *restore(const size_t index,
+            const bool isCurrentPage = true);
+    // Writes the data of a restored entry to a fd, if it has to be streamed
+    // from its blob. Empty, if data() has it. Only valid as long as the
+    // Clipboard is.
+    std::function<void(int)> dataWriter(const ClipboardEntry &entry);
+    // Pinned entries are kept, no matter the RetentionPolicy
+    bool pin(const size_t index, const bool pinned);
+    bool hasPinned() const noexcept;
+    // Removes the oldest entries, until the page fits the policy.
+    // Returns how many got removed.
+    size_t evict(const RetentionPolicy &policy, const bool keepFront = true);
+    // Gives entries, that reference data in page, their own copy of it.
+    // Returns whether there were any.
+    bool materializeRefs(const std::string &page);
+    // Deletes the files of the page
+    void removePage();
+    // Indices of the text entries matching query. Takes the PageLock,
+    // the search index might have to be updated.
+    std::vector<size_t> search(const SearchQuery &query);
+    const ClipboardEntry &entry(const size_t index) const
+    {
+        return entries_.at(index);
+    }
+    size_t size() const noexcept { return entries_.size(); }
 
     void unpackEntries(const std::vector<char> &data);
-    void writePage() const;
+    void unpackEntries(const char *data, const size_t size);
+    void writePage();
     void loadPage();
+    void reloadPage();
+    // Whether another process changed the page since it got loaded. Has
+    // to be checked (and the page reloaded) holding the PageLock, before
+    // changing the page.
+    bool changedOnDisk() const;
+
+    bool needsCompaction() const noexcept;
+    void compactPage();
+
+    const fs::path &pagePath() const noexcept { return pagePath_; }
+    std::string pageName() const { return pagePath_.filename().string(); }
+    bool notSecure() const noexcept { return notSecure_; }
+    void setHistory(const DedupIndex *history) noexcept { history_ = history; }
+    // Bigger entries are not stored
+    static void setMaxEntrySize(const size_t size) noexcept
+    {
+        maxEntrySize_ = size;
+    }
+    static size_t maxEntrySize() noexcept { return maxEntrySize_; }
+    // Enforced on every new entry
+    void setRetention(const RetentionPolicy &retention) noexcept
+    {
+        retention_ = retention;
+    }
+    // Adds where the data of every entry is stored to index
+    void addToIndex(DedupIndex &index) const;
 };
 
 
@@ -0,0 +1,174 @@
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <string_view>
+
+#include <zstd.h>
+#include <zdict.h>
+
+#include "codec.hpp"
+
+static void
+throwIfError(const size_t res, const std::string &msg)
+{
+    if (ZSTD_isError(res))
+        throw std::runtime_error(msg + " (" + ZSTD_getErrorName(res) + ")");
+}
+
+PageCodec::PageCodec() :
+    cctx_{nullptr, [](ZSTD_CCtx *cctx) { ZSTD_freeCCtx(cctx); }},
+    dctx_{nullptr, [](ZSTD_DCtx *dctx) { ZSTD_freeDCtx(dctx); }},
+    cdict_{nullptr, [](ZSTD_CDict *cdict) { ZSTD_freeCDict(cdict); }},
+    ddict_{nullptr, [](ZSTD_DDict *ddict) { ZSTD_freeDDict(ddict); }}
+{
+}
+
+PageCodec::~PageCodec() = default;
+
+bool
+PageCodec::isCompressible(const std::string &mime) noexcept
+{
+    // Everything else (png, jpeg, gif, webp, zip, ...) is compressed already
+    static const std::array<std::string_view, 8> compressible{
+        "application/json", "application/xml", "application/javascript",
+        "application/x-shellscript", "application/x-yaml", "image/svg+xml",
+        "image/bmp", "image/x-portable-pixmap"
+    };
+    return mime.starts_with("text/") || std::find(compressible.begin(),
+            compressible.end(), mime) != compressible.end();
+}
+
+bool
+PageCodec::usesDictionary(const std::string &mime) noexcept
+{
+    return mime.starts_with("text/");
+}
+
+std::vector<char>
+PageCodec::compress(const std::span<const char> data,
+        const std::string &mime) const
+{
+    if (data.size() < CODEC_MIN_SIZE || !isCompressible(mime))
+        return {};
+
+    if (!cctx_)
+        cctx_.reset(ZSTD_createCCtx());
+    const bool withDictionary = hasDictionary() && usesDictionary(mime);
+    if (withDictionary && !cdict_)
+        cdict_.reset(ZSTD_createCDict(dictionary_.data(), dictionary_.size(),
+                    CODEC_LEVEL));
+    if (!cctx_ || (withDictionary && !cdict_))
+        throw std::runtime_error("Failed to set up zstd!");
+
+    std::vector<char> res(ZSTD_compressBound(data.size()));
+    const size_t size = withDictionary ?
+        ZSTD_compress_usingCDict(cctx_.get(), res.data(), res.size(),
+                data.data(), data.size(), cdict_.get()) :
+        ZSTD_compressCCtx(cctx_.get(), res.data(), res.size(), data.data(),
+                data.size(), CODEC_LEVEL);
+    throwIfError(size, "Compressing entry failed!");
+
+    if (size * 100 > data.size() * CODEC_MAX_RATIO)
+        return {};
+    res.resize(size);
+    return res;
+}
+
+size_t
+PageCodec::decompressedSize(const std::span<const char> data)
+{
+    const unsigned long long size = ZSTD_getFrameContentSize(data.data(),
+            data.size());
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+        throw std::runtime_error("Compressed entry is damaged!");
+    return size;
+}
+
+std::vector<char>
+PageCodec::decompress(const std::span<const char> data) const
+{
+    std::vector<char> res(decompressedSize(data));
+    decompress(data, res);
+    return res;
+}
+
+void
+PageCodec::decompress(const std::span<const char> data,
+        const std::span<char> out) const
+{
+    const size_t size = decompressedSize(data);
+    if (out.size() != size)
+        throw std::runtime_error("Buffer does not fit the compressed entry!");
+
+    if (!dctx_)
+        dctx_.reset(ZSTD_createDCtx());
+    if (!dctx_)
+        throw std::runtime_error("Failed to set up zstd!");
+
+    const unsigned dictionaryId = ZSTD_getDictID_fromFrame(data.data(),
+            data.size());
+    size_t got;
+    if (dictionaryId != 0)
+    {
+        if (dictionaryId != dictionaryId_)
+            throw std::runtime_error("Entry was compressed with a dictionary, "
+                    "the page does not have!");
+        if (!ddict_)
+            ddict_.reset(ZSTD_createDDict(dictionary_.data(),
+                        dictionary_.size()));
+        if (!ddict_)
+            throw std::runtime_error("Failed to set up zstd!");
+        got = ZSTD_decompress_usingDDict(dctx_.get(), out.data(), out.size(),
+                data.data(), data.size(), ddict_.get());
+    }
+    else
+        got = ZSTD_decompressDCtx(dctx_.get(), out.data(), out.size(),
+                data.data(), data.size());
+    throwIfError(got, "Decompressing entry failed!");
+    if (got != size)
+        throw std::runtime_error("Compressed entry is truncated!");
+}
+
+void
+PageCodec::setDictionary(std::vector<char> &&dictionary)
+{
+    const unsigned id = ZDICT_getDictID(dictionary.data(), dictionary.size());
+    if (id == 0)
+        throw std::runtime_error("Compression dictionary of the page is damaged!");
+    dictionary_ = std::move(dictionary);
+    dictionaryId_ = id;
+    cdict_.reset();
+    ddict_.reset();
+}
+
+void
+PageCodec::reset() noexcept
+{
+    dictionary_.clear();
+    dictionaryId_ = 0;
+    cdict_.reset();
+    ddict_.reset();
+}
+
+std::vector<char>
+PageCodec::trainDictionary(const std::vector<std::span<const char>> &samples)
+{
+    std::vector<char> sampleBuffer;
+    std::vector<size_t> sampleSizes;
+    for (const std::span<const char> sample : samples)
+    {
+        if (sampleBuffer.size() + sample.size() > CODEC_DICT_MAX_BYTES)
+            break;
+        sampleBuffer.insert(sampleBuffer.end(), sample.begin(), sample.end());
+        sampleSizes.push_back(sample.size());
+    }
+
+    std::vector<char> dictionary(CODEC_DICT_SIZE);
+    const size_t size = ZDICT_trainFromBuffer(dictionary.data(),
+            dictionary.size(), sampleBuffer.data(), sampleSizes.data(),
+            sampleSizes.size());
+    if (ZDICT_isError(size))
+        return {};
+    dictionary.resize(size);
+    return dictionary;
+}
@@ -0,0 +1,71 @@
+#ifndef __WLCLIPMGR_CODEC_HPP
+#define __WLCLIPMGR_CODEC_HPP
+
+#include <span>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#define CODEC_LEVEL 3
+#define CODEC_MIN_SIZE 0x40 // not worth a zstd frame below that
+#define CODEC_MAX_RATIO 90 // keep compressed data only below 90% of the size
+#define CODEC_DICT_SIZE 0x4000
+#define CODEC_DICT_MIN_SAMPLES 0x40
+#define CODEC_DICT_MIN_BYTES 0x10000 // of text, before training a dictionary
+#define CODEC_DICT_MAX_BYTES 0x100000 // samples used for training
+#define CODEC_DICT_RETRY_GROWTH 2 // retry failed training, once the text doubled
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+/*
+    zstd compression of the entries of a page, before they get sealed.
+    Only mime types that compress are tried (text, not png/jpeg/...), and
+    the result is only kept, if it saves at least 10%.
+
+    Text entries are mostly short, so zstd alone does not get far with
+    them. Once a page has enough text, a dictionary gets trained on it,
+    stored in the page index and used for the following text entries.
+*/
+class PageCodec
+{
+    std::vector<char> dictionary_;
+    uint32_t dictionaryId_ = 0;
+
+    // Set up on first use
+    mutable std::unique_ptr<ZSTD_CCtx_s, void (*)(ZSTD_CCtx_s *)> cctx_;
+    mutable std::unique_ptr<ZSTD_DCtx_s, void (*)(ZSTD_DCtx_s *)> dctx_;
+    mutable std::unique_ptr<ZSTD_CDict_s, void (*)(ZSTD_CDict_s *)> cdict_;
+    mutable std::unique_ptr<ZSTD_DDict_s, void (*)(ZSTD_DDict_s *)> ddict_;
+
+    public:
+    PageCodec();
+    ~PageCodec();
+
+    static bool isCompressible(const std::string &mime) noexcept;
+    static bool usesDictionary(const std::string &mime) noexcept;
+
+    // Empty, if data is not worth storing compressed
+    std::vector<char> compress(const std::span<const char> data,
+            const std::string &mime) const;
+    std::vector<char> decompress(const std::span<const char> data) const;
+    // Into out, which has to have the decompressedSize of data
+    void decompress(const std::span<const char> data,
+            const std::span<char> out) const;
+    static size_t decompressedSize(const std::span<const char> data);
+
+    bool hasDictionary() const noexcept { return !dictionary_.empty(); }
+    uint32_t dictionaryId() const noexcept { return dictionaryId_; }
+    const std::vector<char> &dictionary() const noexcept { return dictionary_; }
+    void setDictionary(std::vector<char> &&dictionary);
+    void reset() noexcept;
+
+    // Empty, if zstd could not make a dictionary of the samples
+    static std::vector<char> trainDictionary(
+            const std::vector<std::span<const char>> &samples);
+};
+
+#endif // __WLCLIPMGR_CODEC_HPP
@@ -0,0 +1,60 @@
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <gcrypt.h>
+
+#include "contenthash.hpp"
+#include "sessionkey.hpp"
+
+ContentHash
+hashContent(const char *data, const size_t size)
+{
+    initGcrypt();
+    ContentHash hash;
+    gcry_md_hash_buffer(GCRY_MD_BLAKE2B_256, hash.data(), data, size);
+    return hash;
+}
+
+ContentHasher::ContentHasher()
+{
+    initGcrypt();
+    if (gcry_md_open(&hd_, GCRY_MD_BLAKE2B_256, 0) != 0)
+        throw std::runtime_error("Failed to set up hashing!");
+}
+
+ContentHasher::~ContentHasher()
+{
+    gcry_md_close(hd_);
+}
+
+void
+ContentHasher::update(const char *data, const size_t size)
+{
+    gcry_md_write(hd_, data, size);
+}
+
+ContentHash
+ContentHasher::finish()
+{
+    ContentHash hash;
+    std::memcpy(hash.data(), gcry_md_read(hd_, GCRY_MD_BLAKE2B_256),
+            hash.size());
+    gcry_md_reset(hd_);
+    return hash;
+}
+
+std::string
+hashToString(const ContentHash &hash)
+{
+    return std::string{reinterpret_cast<const char *>(hash.data()),
+        hash.size()};
+}
+
+ContentHash
+hashFromString(const std::string &str)
+{
+    ContentHash hash{};
+    std::memcpy(hash.data(), str.data(), std::min(str.size(), hash.size()));
+    return hash;
+}
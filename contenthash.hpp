@@ -0,0 +1,46 @@
+#ifndef __WLCLIPMGR_CONTENTHASH_HPP
+#define __WLCLIPMGR_CONTENTHASH_HPP
+
+#include <array>
+#include <string>
+#include <cstddef>
+#include <cstring>
+
+#define CONTENT_HASH_SIZE 32 // BLAKE2b-256
+
+using ContentHash = std::array<unsigned char, CONTENT_HASH_SIZE>;
+
+// The hash is uniformly distributed already, any part of it will do
+struct ContentHashHasher
+{
+    size_t operator()(const ContentHash &hash) const noexcept
+    {
+        size_t res;
+        std::memcpy(&res, hash.data(), sizeof(res));
+        return res;
+    }
+};
+
+ContentHash hashContent(const char *data, const size_t size);
+
+struct gcry_md_handle;
+
+// Hashes data, that comes in in pieces
+class ContentHasher
+{
+    gcry_md_handle *hd_;
+
+    public:
+    ContentHasher();
+    ~ContentHasher();
+    ContentHasher(const ContentHasher &) = delete;
+    ContentHasher &operator=(const ContentHasher &) = delete;
+
+    void update(const char *data, const size_t size);
+    ContentHash finish();
+};
+
+std::string hashToString(const ContentHash &hash);
+ContentHash hashFromString(const std::string &str);
+
+#endif // __WLCLIPMGR_CONTENTHASH_HPP
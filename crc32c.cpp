@@ -0,0 +1,114 @@
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "crc32c.hpp"
+
+#define CRC32C_POLY 0x82f63b78 // reversed
+
+using CrcTables = std::array<std::array<uint32_t, 256>, 8>;
+
+static constexpr CrcTables
+makeTables()
+{
+    CrcTables tables{};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (size_t t = 1; t < tables.size(); t++)
+            tables[t][i] = (tables[t - 1][i] >> 8) ^
+                tables[0][tables[t - 1][i] & 0xff];
+    }
+    return tables;
+}
+
+static constexpr CrcTables crcTables = makeTables();
+
+static uint32_t
+crc32cSoftware(const unsigned char *data, size_t size, uint32_t crc)
+{
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, data, sizeof(low));
+        std::memcpy(&high, data + 4, sizeof(high));
+        low ^= crc;
+        crc = crcTables[7][low & 0xff] ^ crcTables[6][(low >> 8) & 0xff] ^
+            crcTables[5][(low >> 16) & 0xff] ^ crcTables[4][low >> 24] ^
+            crcTables[3][high & 0xff] ^ crcTables[2][(high >> 8) & 0xff] ^
+            crcTables[1][(high >> 16) & 0xff] ^ crcTables[0][high >> 24];
+    }
+    for (; size > 0; data++, size--)
+        crc = (crc >> 8) ^ crcTables[0][(crc ^ *data) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32cHardware(const unsigned char *data, size_t size, uint32_t crc)
+{
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; data++, size--)
+        crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+
+static bool
+hasHardwareCrc()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t
+crc32cHardware(const unsigned char *data, size_t size, uint32_t crc)
+{
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = __crc32cd(crc, word);
+    }
+    for (; size > 0; data++, size--)
+        crc = __crc32cb(crc, *data);
+    return crc;
+}
+
+static bool
+hasHardwareCrc()
+{
+    return true;
+}
+#endif
+
+uint32_t
+crc32c(const char *data, const size_t size, const uint32_t crc)
+{
+    const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+#if defined(__x86_64__) || defined(__ARM_FEATURE_CRC32)
+    static const bool hardware = hasHardwareCrc();
+    if (hardware)
+        return ~crc32cHardware(bytes, size, ~crc);
+#endif
+    return ~crc32cSoftware(bytes, size, ~crc);
+}
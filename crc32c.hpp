@@ -0,0 +1,15 @@
+#ifndef __WLCLIPMGR_CRC32C_HPP
+#define __WLCLIPMGR_CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+    CRC-32C (Castagnoli), what the page logs are checksummed with. Uses
+    the crc32 instructions of SSE 4.2 (or ARMv8, if built for it), when
+    the cpu has them, otherwise a table per byte of 8 at a time.
+    crc is the result for the data before, to checksum it in pieces.
+*/
+uint32_t crc32c(const char *data, const size_t size, const uint32_t crc = 0);
+
+#endif // __WLCLIPMGR_CRC32C_HPP
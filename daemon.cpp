@@ -0,0 +1,819 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string_view>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "daemon.hpp"
+#include "procblock.hpp"
+#include "trace.hpp"
+#include "mimesniff.hpp"
+#include "pagelock.hpp"
+#include "gpgmeinterface.hpp"
+
+static sockaddr_un
+makeAddress(const fs::path &socketPath)
+{
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    const std::string path = socketPath.string();
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+static int
+connectTo(const fs::path &socketPath)
+{
+    const sockaddr_un addr = makeAddress(socketPath);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (const sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool
+writeAll(const int fd, const char *buf, size_t size)
+{
+    while (size > 0)
+    {
+        const ssize_t written = send(fd, buf, size, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += written;
+        size -= written;
+    }
+    return true;
+}
+
+// Move everything from inFd to outFd. Uses splice, if inFd is a pipe
+// (like it is, when wl-paste invokes us), otherwise read/write.
+static bool
+forwardAll(const int inFd, const int outFd)
+{
+    while (true)
+    {
+        const ssize_t moved = splice(inFd, NULL, outFd, NULL, 0x10000,
+                SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved == 0)
+            return true;
+        if (moved > 0)
+            continue;
+        if (errno == EINTR)
+            continue;
+        if (errno == EINVAL)
+            break;
+        // The daemon hung up early, because it does not want the rest
+        return errno == EPIPE || errno == ECONNRESET;
+    }
+
+    char buf[0x10000];
+    while (true)
+    {
+        const ssize_t got = read(inFd, buf, sizeof(buf));
+        if (got == 0)
+            return true;
+        if (got < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (!writeAll(outFd, buf, got))
+            return errno == EPIPE || errno == ECONNRESET;
+    }
+}
+
+Daemon::Daemon(const fs::path &cacheDir, const std::string &page,
+        const std::function<std::string()> &defaultPage,
+        const std::string &gpgUserName, bool notSecure,
+        const std::string &blockOption, const RetentionPolicy &retention,
+        const StoreBatching &batching) :
+    cacheDir_{cacheDir}, socketPath_{socketPath(cacheDir)}, page_{page},
+    defaultPage_{defaultPage}, gpgUserName_{gpgUserName},
+    notSecure_{notSecure}, blockOption_{blockOption}, retention_{retention},
+    batching_{batching}
+{
+    listen();
+}
+
+Daemon::~Daemon()
+{
+    for (const SelectionTransfer &transfer : transfers_)
+    {
+        for (const SelectionTransfer::Part &part : transfer.parts_)
+        {
+            if (part.fd_ >= 0)
+                close(part.fd_);
+        }
+    }
+    for (const SocketClient &client : clients_)
+        close(client.fd_);
+    if (listenFd_ < 0)
+        return;
+    close(listenFd_);
+    std::error_code ec;
+    fs::remove(socketPath_, ec);
+}
+
+fs::path
+Daemon::socketPath(const fs::path &cacheDir)
+{
+    // One daemon per wayland session
+    const char *display = std::getenv("WAYLAND_DISPLAY");
+    const std::string name = "wlclipmgr-" +
+        fs::path{display == NULL ? "wayland-0" : display}.filename().string() +
+        ".sock";
+
+    const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir == NULL)
+        return cacheDir / name;
+    return fs::path{runtimeDir} / name;
+}
+
+void
+Daemon::listen()
+{
+    const int probeFd = connectTo(socketPath_);
+    if (probeFd >= 0)
+    {
+        close(probeFd);
+        throw std::runtime_error("A wlclipmgr daemon is already listening on "
+                + socketPath_.string());
+    }
+    // Stale socket of a daemon that did not exit cleanly
+    std::error_code ec;
+    fs::remove(socketPath_, ec);
+
+    const sockaddr_un addr = makeAddress(socketPath_);
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd_ < 0)
+        throw std::runtime_error("Failed to create the daemon socket!");
+
+    const mode_t oldMask = umask(077);
+    const int bindRes = bind(listenFd_, (const sockaddr *)&addr, sizeof(addr));
+    umask(oldMask);
+    if (bindRes != 0 || ::listen(listenFd_, 16) != 0)
+    {
+        close(listenFd_);
+        listenFd_ = -1;
+        throw std::runtime_error("Failed to listen on "
+                + socketPath_.string() + ": " + std::strerror(errno));
+    }
+}
+
+std::string
+Daemon::pageName() const
+{
+    return page_.empty() ? defaultPage_() : page_;
+}
+
+Clipboard &
+Daemon::clipboard()
+{
+    // Every store is a command of its own, the keys might have changed
+    GpgMEInterface::refreshKeyringStamp();
+    const std::string page = pageName();
+    if (!clipboard_ || page != currentPage_)
+    {
+        // The page of yesterday is history now
+        if (clipboard_)
+        {
+            clipboard_->addToIndex(history_);
+            pruneDue_ = true;
+        }
+        clipboard_ = std::make_unique<Clipboard>(
+            cacheDir_ / page,
+            gpgUserName_,
+            notSecure_
+        );
+        clipboard_->loadPage();
+        clipboard_->setHistory(&history_);
+        clipboard_->setRetention(retention_);
+        currentPage_ = page;
+    }
+    // restore (and everything else not going through the daemon)
+    // writes the page directly
+    else if (clipboard_->changedOnDisk())
+        clipboard_->reloadPage();
+
+    return *clipboard_;
+}
+
+void
+Daemon::loadHistory()
+{
+    std::vector<fs::path> indexPaths;
+    for (const fs::directory_entry &file : fs::directory_iterator{cacheDir_})
+    {
+        const fs::path &path = file.path();
+        if (path.extension() == ".idx" && path.stem() != currentPage_)
+            indexPaths.push_back(path);
+    }
+    // Oldest first, so the newest copy of some content wins
+    std::sort(indexPaths.begin(), indexPaths.end(),
+        [](const fs::path &a, const fs::path &b)
+        {
+            return fs::last_write_time(a) < fs::last_write_time(b);
+        });
+
+    for (const fs::path &indexPath : indexPaths)
+    {
+        try
+        {
+            Clipboard page{cacheDir_ / indexPath.stem(), gpgUserName_,
+                notSecure_};
+            page.loadPage();
+            page.addToIndex(history_);
+        }
+        catch (const std::exception &err)
+        {
+            std::cerr << "Skipping page " << indexPath.stem().string()
+                << " for deduplication: " << err.what() << std::endl;
+        }
+    }
+}
+
+void
+Daemon::maintain()
+{
+    if (pruneDue_ && retention_.maxAgeDays_ != 0)
+    {
+        pruneDue_ = false;
+        try
+        {
+            // Entries of dropped pages must not be referenced anymore
+            if (pruneHistory(cacheDir_, currentPage_, retention_,
+                        gpgUserName_, notSecure_))
+            {
+                history_ = DedupIndex{};
+                loadHistory();
+            }
+        }
+        catch (const std::exception &err)
+        {
+            std::cerr << "Failed to prune old pages: " << err.what()
+                << std::endl;
+        }
+    }
+    try
+    {
+        const PageLock lock{cacheDir_ / pageName()};
+        Clipboard &clip = clipboard();
+        if (clip.needsCompaction())
+            clip.compactPage();
+    }
+    catch (const std::exception &err)
+    {
+        std::cerr << "Failed to compact the page: " << err.what()
+            << std::endl;
+    }
+    Tracer::instance().flush();
+}
+
+void
+Daemon::watch(const bool primary)
+{
+    watchPrimary_ = primary;
+    dataControl_ = std::make_unique<DataControl>();
+    dataControl_->watch([this](const std::vector<std::string> &mimeTypes,
+                bool isPrimary)
+            {
+                onSelection(mimeTypes, isPrimary);
+            });
+}
+
+void
+Daemon::run()
+{
+    // Pay for loading the page, gpg and xdgmime up front
+    {
+        const PageLock lock{cacheDir_ / pageName()};
+        clipboard();
+    }
+    loadHistory();
+    preloadMimeDatabase();
+    Tracer::instance().flush();
+
+    std::vector<pollfd> fds;
+    // Transfer and part of fds[firstPart + i]
+    std::vector<std::pair<size_t, size_t>> partFds;
+    while (true)
+    {
+        fds.assign({{listenFd_, POLLIN, 0}});
+        if (dataControl_)
+        {
+            dataControl_->flush();
+            fds.push_back({dataControl_->fd(), POLLIN, 0});
+        }
+        const size_t firstPart = fds.size();
+        partFds.clear();
+        for (size_t i = 0; i < transfers_.size(); i++)
+        {
+            for (size_t j = 0; j < transfers_[i].parts_.size(); j++)
+            {
+                const int fd = transfers_[i].parts_[j].fd_;
+                if (fd < 0)
+                    continue;
+                fds.push_back({fd, POLLIN, 0});
+                partFds.push_back({i, j});
+            }
+        }
+        const size_t firstClient = fds.size();
+        for (const SocketClient &client : clients_)
+            fds.push_back({client.fd_, POLLIN, 0});
+
+        // Compact the page log (and prune old pages), once no copies
+        // came in for a while
+        const bool maintenance = (clipboard_ &&
+                clipboard_->needsCompaction()) ||
+            (pruneDue_ && retention_.maxAgeDays_ != 0);
+        int timeout = !pending_.empty() ? batchTimeout() :
+            maintenance ? DAEMON_COMPACT_AFTER_IDLE_MS : -1;
+        if (!transfers_.empty())
+            timeout = timeout < 0 ? transferTimeout() :
+                std::min(timeout, transferTimeout());
+        if (!clients_.empty())
+            timeout = timeout < 0 ? clientTimeout() :
+                std::min(timeout, clientTimeout());
+        const int ready = poll(fds.data(), fds.size(), timeout);
+        if (ready < 0)
+        {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Daemon poll failed!");
+        }
+        // Also while a burst keeps coming in
+        if (!pending_.empty() && batchTimeout() == 0)
+            commitStores();
+        // Also while other clients keep sending
+        if (!clients_.empty())
+            expireClients();
+        if (ready == 0)
+        {
+            if (!transfers_.empty())
+            {
+                expireTransfers();
+                finishTransfers();
+            }
+            else if (pending_.empty() && clients_.empty())
+                maintain();
+            continue;
+        }
+
+        for (size_t i = firstPart; i < firstClient; i++)
+        {
+            if (fds[i].revents == 0)
+                continue;
+            const auto [transfer, part] = partFds[i - firstPart];
+            readTransfer(transfers_[transfer].parts_[part]);
+        }
+        finishTransfers();
+
+        // Expiring clients only drops them, so they still line up with fds
+        std::vector<int> doneFds;
+        for (size_t i = firstClient; i < fds.size(); i++)
+        {
+            if (fds[i].revents == 0)
+                continue;
+            const auto client = std::find_if(clients_.begin(),
+                    clients_.end(), [&](const SocketClient &client)
+                    {
+                        return client.fd_ == fds[i].fd;
+                    });
+            if (client != clients_.end() && readClient(*client))
+                doneFds.push_back(client->fd_);
+        }
+        std::erase_if(clients_, [&](const SocketClient &client)
+            {
+                if (std::find(doneFds.begin(), doneFds.end(), client.fd_) ==
+                        doneFds.end())
+                    return false;
+                close(client.fd_);
+                return true;
+            });
+
+        if (dataControl_ && fds[1].revents != 0 && !dataControl_->dispatch())
+        {
+            // The compositor is gone
+            commitStores();
+            return;
+        }
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        const int clientFd = accept4(listenFd_, NULL, NULL,
+                SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (clientFd < 0)
+            continue;
+        clients_.push_back({clientFd, {}, {}, {},
+                std::chrono::steady_clock::now() +
+                std::chrono::milliseconds{DAEMON_CLIENT_TIMEOUT_MS}});
+    }
+}
+
+// Text is offered under a bunch of names, it is only stored once
+static bool
+isTextAlias(const std::string &mime)
+{
+    return mime.starts_with("text/plain") || mime == "UTF8_STRING" ||
+        mime == "STRING" || mime == "TEXT";
+}
+
+// What to store of a selection: the main representation (text, else an
+// image, else whatever comes first), then the alternatives
+static std::vector<std::string>
+selectMimeTypes(const std::vector<std::string> &offered)
+{
+    static const std::vector<std::string> textNames{
+        "text/plain;charset=utf-8", "text/plain", "UTF8_STRING", "STRING",
+        "TEXT"
+    };
+    const auto isOffered = [&](const std::string &mime)
+    {
+        return std::find(offered.begin(), offered.end(), mime) != offered.end();
+    };
+
+    std::vector<std::string> selected;
+    const auto text = std::find_if(textNames.begin(), textNames.end(),
+            isOffered);
+    if (text != textNames.end())
+        selected.push_back(*text);
+    else
+    {
+        auto image = std::find(offered.begin(), offered.end(), "image/png");
+        if (image == offered.end())
+            image = std::find_if(offered.begin(), offered.end(),
+                [](const std::string &mime) { return mime.starts_with("image/"); });
+        if (image != offered.end())
+            selected.push_back(*image);
+    }
+
+    for (const std::string &mime : offered)
+    {
+        if (selected.size() > WATCH_MAX_ALTERNATIVES)
+            break;
+        // Anything without a slash is some X11 target like TIMESTAMP
+        if (isTextAlias(mime) || mime.find('/') == std::string::npos ||
+                std::find(selected.begin(), selected.end(), mime) !=
+                selected.end())
+            continue;
+        selected.push_back(mime);
+    }
+    return selected;
+}
+
+void
+Daemon::onSelection(const std::vector<std::string> &mimeTypes,
+        const bool primary)
+{
+    if (primary && !watchPrimary_)
+        return;
+
+    // A new selection makes the one still being read obsolete
+    for (auto it = transfers_.begin(); it != transfers_.end();)
+    {
+        if (it->primary_ != primary)
+        {
+            it++;
+            continue;
+        }
+        for (const SelectionTransfer::Part &part : it->parts_)
+        {
+            if (part.fd_ >= 0)
+                close(part.fd_);
+        }
+        it = transfers_.erase(it);
+    }
+
+    const std::vector<std::string> selected = selectMimeTypes(mimeTypes);
+    if (selected.empty())
+        return;
+
+    SelectionTransfer transfer{{}, primary, std::chrono::steady_clock::now() +
+        std::chrono::milliseconds{DAEMON_CLIENT_TIMEOUT_MS}};
+    for (const std::string &mime : selected)
+    {
+        transfer.parts_.push_back({mime, dataControl_->receive(mime, primary),
+                std::make_unique<Ingest>(Clipboard::maxEntrySize())});
+    }
+    transfers_.push_back(std::move(transfer));
+}
+
+void
+Daemon::readTransfer(SelectionTransfer::Part &part)
+{
+    try
+    {
+        if (!part.ingest_->readSome(part.fd_))
+            return;
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << "Failed to receive " << part.mime_ << ": " << err.what()
+            << std::endl;
+        part.ingest_.reset();
+    }
+    close(part.fd_);
+    part.fd_ = -1;
+}
+
+int
+Daemon::transferTimeout() const
+{
+    const auto now = std::chrono::steady_clock::now();
+    auto deadline = transfers_.front().deadline_;
+    for (const SelectionTransfer &transfer : transfers_)
+        deadline = std::min(deadline, transfer.deadline_);
+    if (deadline <= now)
+        return 0;
+    return std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+}
+
+void
+Daemon::expireTransfers()
+{
+    // Give up on the parts, that still did not arrive
+    const auto now = std::chrono::steady_clock::now();
+    for (SelectionTransfer &transfer : transfers_)
+    {
+        if (transfer.deadline_ > now)
+            continue;
+        for (SelectionTransfer::Part &part : transfer.parts_)
+        {
+            if (part.fd_ < 0)
+                continue;
+            std::cerr << "Timed out receiving " << part.mime_ << std::endl;
+            close(part.fd_);
+            part.fd_ = -1;
+            part.ingest_.reset();
+        }
+    }
+}
+
+void
+Daemon::finishTransfers()
+{
+    for (auto it = transfers_.begin(); it != transfers_.end();)
+    {
+        const bool done = std::all_of(it->parts_.begin(), it->parts_.end(),
+            [](const SelectionTransfer::Part &part) { return part.fd_ < 0; });
+        if (!done)
+        {
+            it++;
+            continue;
+        }
+        try
+        {
+            storeTransfer(*it);
+        }
+        catch (const std::exception &err)
+        {
+            std::cerr << "Failed to store the selection: " << err.what()
+                << std::endl;
+        }
+        it = transfers_.erase(it);
+    }
+}
+
+void
+Daemon::storeTransfer(SelectionTransfer &transfer)
+{
+    std::unique_ptr<Ingest> &main = transfer.parts_.front().ingest_;
+    if (!main)
+        return;
+
+    std::vector<EntryAlternative> alternatives;
+    for (size_t i = 1; i < transfer.parts_.size(); i++)
+    {
+        SelectionTransfer::Part &part = transfer.parts_[i];
+        if (!part.ingest_ || part.ingest_->tooBig() || part.ingest_->size() == 0)
+            continue;
+        EntryAlternative alternative;
+        alternative.mime_ = part.mime_;
+        alternative.data_.buffer_ = part.ingest_->take();
+        alternative.size_ = alternative.data_.buffer_.size();
+        alternatives.push_back(std::move(alternative));
+    }
+
+    if (!blockOption_.empty() && isProcBlocking(blockOption_))
+        return;
+    queueStore({std::move(main), std::move(alternatives)});
+}
+
+static bool
+sameData(const Ingest &a, const Ingest &b)
+{
+    return a.size() == b.size() && std::memcmp(a.data().data(),
+            b.data().data(), a.size()) == 0;
+}
+
+// b is a (pure) text, that a grew into at either end
+static bool
+supersedes(const PendingStore &a, const PendingStore &b)
+{
+    if (!b.alternatives_.empty())
+        return false;
+    const std::string_view grown{a.selection_->data().data(),
+        a.selection_->size()};
+    const std::string_view text{b.selection_->data().data(),
+        b.selection_->size()};
+    return grown.size() > text.size() && isPlainText(b.selection_->data()) &&
+        (grown.starts_with(text) || grown.ends_with(text));
+}
+
+void
+Daemon::queueStore(PendingStore &&store)
+{
+    const Ingest &selection = *store.selection_;
+    if (batching_.windowMs_ > 0 && !selection.tooBig() && selection.size() > 0)
+    {
+        // Copied again within the burst, only the last one counts
+        std::erase_if(pending_, [&](const PendingStore &pending)
+            {
+                return !pending.selection_->tooBig() &&
+                    sameData(*pending.selection_, selection);
+            });
+        if (batching_.dropSuperseded_ && !pending_.empty() &&
+                supersedes(store, pending_.back()))
+            pending_.pop_back();
+    }
+    if (pending_.empty())
+        batchDeadline_ = std::chrono::steady_clock::now() +
+            std::chrono::milliseconds{batching_.windowMs_};
+    pending_.push_back(std::move(store));
+    if (batching_.windowMs_ == 0)
+        commitStores();
+}
+
+int
+Daemon::batchTimeout() const
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (batchDeadline_ <= now)
+        return 0;
+    return std::chrono::ceil<std::chrono::milliseconds>(batchDeadline_ - now)
+        .count();
+}
+
+void
+Daemon::commitStores()
+{
+    if (pending_.empty())
+        return;
+    std::vector<PendingStore> pending = std::move(pending_);
+    pending_.clear();
+    try
+    {
+        TraceSpan span{"commitStores"};
+        const PageLock lock{cacheDir_ / pageName()};
+        Clipboard &clip = clipboard();
+        bool added = false;
+        for (PendingStore &store : pending)
+            added |= clip.addEntry(std::move(*store.selection_), "",
+                    std::move(store.alternatives_));
+        if (added)
+            clip.writePage();
+    }
+    catch (const std::exception &err)
+    {
+        std::cerr << "Failed to store " << pending.size() << " selection(s): "
+            << err.what() << std::endl;
+    }
+    Tracer::instance().flush();
+}
+
+bool
+Daemon::readClient(SocketClient &client)
+{
+    client.deadline_ = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds{DAEMON_CLIENT_TIMEOUT_MS};
+    try
+    {
+        if (!client.selection_)
+        {
+            // Header: "<command>\n<page>\n<block option>\n<gpg user>\n
+            // <no encryption 0/1>\n<max entry size>\n"
+            // The client waits for our reply, before sending the selection.
+            char chunk[0x200];
+            while (std::count(client.header_.begin(), client.header_.end(),
+                        '\n') < 6)
+            {
+                const ssize_t got = read(client.fd_, chunk, sizeof(chunk));
+                if (got < 0 && errno == EINTR)
+                    continue;
+                if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    return false;
+                if (got <= 0)
+                    return true;
+                client.header_.append(chunk, got);
+            }
+            auto header = stringSplit(client.header_, '\n');
+            header.resize(6);
+            const std::string &command = header[0];
+            const std::string &page = header[1];
+            client.blockOption_ = header[2];
+
+            // Stored with other settings than asked for otherwise, the
+            // client stores it itself then
+            const bool sameSettings = header[3] == gpgUserName_ &&
+                header[4] == (notSecure_ ? "1" : "0") &&
+                header[5] == std::to_string(Clipboard::maxEntrySize());
+            const bool accept = command == "store" && sameSettings &&
+                (page.empty() ? page_.empty() : page == pageName());
+            if (!writeAll(client.fd_, accept ? "y" : "n", 1) || !accept)
+                return true;
+            client.selection_ = std::make_unique<Ingest>(
+                    Clipboard::maxEntrySize());
+        }
+        if (!client.selection_->readSome(client.fd_))
+            return false;
+    }
+    catch (const std::exception &err)
+    {
+        // One bad selection should not take down the daemon
+        std::cerr << "Failed to handle client: " << err.what() << std::endl;
+        return true;
+    }
+
+    // Too big ones are dropped right away, the client stops sending
+    // once we hang up.
+    const std::string &blockOption = client.blockOption_.empty() ?
+        blockOption_ : client.blockOption_;
+    if (!blockOption.empty() && isProcBlocking(blockOption))
+        return true;
+    queueStore({std::move(client.selection_), {}});
+    return true;
+}
+
+void
+Daemon::expireClients()
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::erase_if(clients_, [&](const SocketClient &client)
+        {
+            if (client.deadline_ > now)
+                return false;
+            std::cerr << "Failed to handle client: Timed out reading the "
+                "selection!" << std::endl;
+            close(client.fd_);
+            return true;
+        });
+}
+
+int
+Daemon::clientTimeout() const
+{
+    const auto now = std::chrono::steady_clock::now();
+    auto deadline = clients_.front().deadline_;
+    for (const SocketClient &client : clients_)
+        deadline = std::min(deadline, client.deadline_);
+    if (deadline <= now)
+        return 0;
+    return std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+}
+
+bool
+Daemon::forwardStore(const fs::path &socketPath, const std::string &page,
+        const std::string &blockOption, const std::string &gpgUserName,
+        const bool notSecure)
+{
+    TraceSpan span{"forwardStore"};
+    const int fd = connectTo(socketPath);
+    if (fd < 0)
+        return false;
+
+    const std::string header = "store\n" + page + "\n" + blockOption + "\n"
+        + gpgUserName + "\n" + (notSecure ? "1" : "0") + "\n"
+        + std::to_string(Clipboard::maxEntrySize()) + "\n";
+    char reply = 'n';
+    if (!writeAll(fd, header.data(), header.size()) ||
+            read(fd, &reply, 1) != 1 || reply != 'y')
+    {
+        close(fd);
+        return false;
+    }
+
+    std::signal(SIGPIPE, SIG_IGN);
+    const bool forwarded = forwardAll(STDIN_FILENO, fd);
+    close(fd);
+    if (!forwarded)
+        throw std::runtime_error("Failed to forward the clipboard to the daemon!");
+    return true;
+}
@@ -0,0 +1,148 @@
+#ifndef __WLCLIPMGR_DAEMON_HPP
+#define __WLCLIPMGR_DAEMON_HPP
+
+#include <string>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "clipboard.hpp"
+#include "dedupindex.hpp"
+#include "datacontrol.hpp"
+#include "ingest.hpp"
+
+#define DAEMON_COMPACT_AFTER_IDLE_MS 2000 // also prunes old pages then
+#define DAEMON_CLIENT_TIMEOUT_MS 5000
+#define WATCH_MAX_ALTERNATIVES 4
+
+// A selection, that is being read from the client offering it
+struct SelectionTransfer
+{
+    struct Part
+    {
+        std::string mime_;
+        int fd_; // -1 once done
+        std::unique_ptr<Ingest> ingest_; // null, if reading failed
+    };
+    // The first part becomes the entry, the others its alternatives
+    std::vector<Part> parts_;
+    bool primary_;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+// A `wlclipmgr store` forwarding its stdin, read along with everything
+// else the daemon waits for
+struct SocketClient
+{
+    int fd_;
+    // Until the header is complete
+    std::string header_;
+    std::string blockOption_;
+    // Once the store got accepted
+    std::unique_ptr<Ingest> selection_;
+    // Pushed back, whenever something arrives
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+// A selection waiting to be stored together with the rest of its burst
+struct PendingStore
+{
+    std::unique_ptr<Ingest> selection_;
+    std::vector<EntryAlternative> alternatives_;
+};
+
+/*
+    Selections coming in within windowMs_ of the first one are stored
+    together, with a single write of the page. Copies of the same data
+    are stored once. With dropSuperseded_, a text that the next
+    selection extends (selecting by dragging) is dropped as well.
+*/
+struct StoreBatching
+{
+    int windowMs_ = 0; // 0: store every selection right away
+    bool dropSuperseded_ = false;
+};
+
+/*
+    Long running wlclipmgr process, that keeps the Clipboard (and with it
+    the gpg context and the xdgmime database) resident.
+    New selections are received from the compositor directly, when
+    watching, or handed in over a unix socket by `wlclipmgr store`, which
+    only forwards its stdin, if a daemon is running. Everything is read
+    without blocking from a single poll loop, so a stalled client does
+    not hold up the others (or the compositor).
+*/
+class Daemon
+{
+    const fs::path cacheDir_;
+    const fs::path socketPath_;
+    const std::string page_; // empty -> rotate with defaultPage_
+    const std::function<std::string()> defaultPage_;
+    const std::string gpgUserName_;
+    const bool notSecure_;
+    const std::string blockOption_;
+    const RetentionPolicy retention_;
+    const StoreBatching batching_;
+
+    std::unique_ptr<Clipboard> clipboard_;
+    std::string currentPage_;
+    // Entries of all other pages, so copying something again on another
+    // day only stores a reference to it
+    DedupIndex history_;
+    // Old pages get pruned, once idle after starting or a new day
+    bool pruneDue_ = true;
+    int listenFd_ = -1;
+
+    std::unique_ptr<DataControl> dataControl_;
+    bool watchPrimary_ = false;
+    std::vector<SelectionTransfer> transfers_;
+    std::vector<SocketClient> clients_;
+    std::vector<PendingStore> pending_;
+    std::chrono::steady_clock::time_point batchDeadline_;
+
+    std::string pageName() const;
+    // Take the PageLock of pageName() first, when changing it
+    Clipboard &clipboard();
+    void loadHistory();
+    void maintain();
+    void listen();
+    // Returns true, once the client is done with
+    bool readClient(SocketClient &client);
+    void expireClients();
+    int clientTimeout() const;
+
+    void onSelection(const std::vector<std::string> &mimeTypes,
+            const bool primary);
+    void readTransfer(SelectionTransfer::Part &part);
+    void expireTransfers();
+    void finishTransfers();
+    void storeTransfer(SelectionTransfer &transfer);
+    int transferTimeout() const;
+    void queueStore(PendingStore &&store);
+    void commitStores();
+    int batchTimeout() const;
+
+    public:
+    Daemon(const fs::path &cacheDir, const std::string &page,
+            const std::function<std::string()> &defaultPage,
+            const std::string &gpgUserName, bool notSecure,
+            const std::string &blockOption, const RetentionPolicy &retention,
+            const StoreBatching &batching);
+    ~Daemon();
+
+    // Receive new selections from the compositor, not only over the socket
+    void watch(const bool primary);
+    // Serve until the compositor is gone (forever, if not watching)
+    void run();
+
+    static fs::path socketPath(const fs::path &cacheDir);
+    // Returns false, if there is no daemon willing to store for this page
+    // with these settings.
+    static bool forwardStore(const fs::path &socketPath,
+            const std::string &page, const std::string &blockOption,
+            const std::string &gpgUserName, const bool notSecure);
+};
+
+#endif // __WLCLIPMGR_DAEMON_HPP
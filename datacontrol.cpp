@@ -0,0 +1,310 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include "wlr-data-control-unstable-v1-client-protocol.h"
+
+#include "datacontrol.hpp"
+
+const wl_registry_listener DataControl::registryListener_{
+    DataControl::onGlobal,
+    DataControl::onGlobalRemove
+};
+
+const zwlr_data_control_device_v1_listener DataControl::deviceListener_{
+    DataControl::onDataOffer,
+    DataControl::onSelection,
+    DataControl::onFinished,
+    DataControl::onPrimarySelection
+};
+
+const zwlr_data_control_source_v1_listener DataControl::sourceListener_{
+    DataControl::onSend,
+    DataControl::onCancelled
+};
+
+const zwlr_data_control_offer_v1_listener DataControl::offerListener_{
+    DataControl::onOffer
+};
+
+DataControl::DataControl()
+{
+    display_ = wl_display_connect(NULL);
+    if (display_ == nullptr)
+        throw std::runtime_error("Failed to connect to the wayland display!");
+
+    registry_ = wl_display_get_registry(display_);
+    wl_registry_add_listener(registry_, &registryListener_, this);
+    wl_display_roundtrip(display_);
+    if (manager_ == nullptr || seat_ == nullptr)
+    {
+        disconnect();
+        throw std::runtime_error(
+                "The compositor does not support wlr-data-control!");
+    }
+
+    device_ = zwlr_data_control_manager_v1_get_data_device(manager_, seat_);
+    zwlr_data_control_device_v1_add_listener(device_, &deviceListener_, this);
+}
+
+DataControl::~DataControl()
+{
+    disconnect();
+}
+
+void
+DataControl::disconnect()
+{
+    dropSource();
+    for (const auto &[offer, mimeTypes] : offers_)
+        zwlr_data_control_offer_v1_destroy(offer);
+    offers_.clear();
+    selection_ = nullptr;
+    primarySelection_ = nullptr;
+    if (device_)
+        zwlr_data_control_device_v1_destroy(device_);
+    if (manager_)
+        zwlr_data_control_manager_v1_destroy(manager_);
+    if (seat_)
+        wl_seat_destroy(seat_);
+    if (registry_)
+        wl_registry_destroy(registry_);
+    if (display_)
+        wl_display_disconnect(display_);
+    device_ = nullptr;
+    manager_ = nullptr;
+    seat_ = nullptr;
+    registry_ = nullptr;
+    display_ = nullptr;
+}
+
+void
+DataControl::onGlobal(void *data, wl_registry *registry, uint32_t name,
+        const char *interface, uint32_t version)
+{
+    DataControl *self = static_cast<DataControl *>(data);
+    // First seat only, like wl-copy without --seat
+    if (std::strcmp(interface, wl_seat_interface.name) == 0 && !self->seat_)
+        self->seat_ = static_cast<wl_seat *>(wl_registry_bind(registry, name,
+                    &wl_seat_interface, 1));
+    else if (std::strcmp(interface,
+                zwlr_data_control_manager_v1_interface.name) == 0)
+        self->manager_ = static_cast<zwlr_data_control_manager_v1 *>(
+                wl_registry_bind(registry, name,
+                    &zwlr_data_control_manager_v1_interface,
+                    version < 2 ? version : 2));
+}
+
+void
+DataControl::onGlobalRemove(void *, wl_registry *, uint32_t)
+{
+}
+
+void
+DataControl::onDataOffer(void *data, zwlr_data_control_device_v1 *,
+        zwlr_data_control_offer_v1 *offer)
+{
+    // The mime types follow, then the offer becomes a selection
+    DataControl *self = static_cast<DataControl *>(data);
+    self->offers_[offer];
+    zwlr_data_control_offer_v1_add_listener(offer, &offerListener_, self);
+}
+
+void
+DataControl::onOffer(void *data, zwlr_data_control_offer_v1 *offer,
+        const char *mimeType)
+{
+    static_cast<DataControl *>(data)->offers_[offer].push_back(mimeType);
+}
+
+void
+DataControl::onSelection(void *data, zwlr_data_control_device_v1 *,
+        zwlr_data_control_offer_v1 *offer)
+{
+    DataControl *self = static_cast<DataControl *>(data);
+    self->setSelection(self->selection_, offer, false);
+}
+
+void
+DataControl::onPrimarySelection(void *data, zwlr_data_control_device_v1 *,
+        zwlr_data_control_offer_v1 *offer)
+{
+    DataControl *self = static_cast<DataControl *>(data);
+    self->setSelection(self->primarySelection_, offer, true);
+}
+
+void
+DataControl::setSelection(zwlr_data_control_offer_v1 *&current,
+        zwlr_data_control_offer_v1 *offer, const bool primary)
+{
+    // The previous offer is done with, unless it still is the other
+    // selection as well
+    const zwlr_data_control_offer_v1 *other = primary ? selection_ :
+        primarySelection_;
+    if (current && current != other)
+    {
+        zwlr_data_control_offer_v1_destroy(current);
+        offers_.erase(current);
+    }
+    current = offer;
+    if (offer && onNewSelection_)
+        onNewSelection_(offers_[offer], primary);
+}
+
+void
+DataControl::onFinished(void *data, zwlr_data_control_device_v1 *device)
+{
+    DataControl *self = static_cast<DataControl *>(data);
+    zwlr_data_control_device_v1_destroy(device);
+    self->device_ = nullptr;
+    self->dropSource();
+}
+
+void
+DataControl::onSend(void *data, zwlr_data_control_source_v1 *,
+        const char *mimeType, int32_t fd)
+{
+    const DataControl *self = static_cast<DataControl *>(data);
+    const auto offered = std::find_if(self->offered_.begin(),
+            self->offered_.end(), [&](const OfferedData &candidate)
+            {
+                const auto &mimeTypes = candidate.mimeTypes_;
+                return std::find(mimeTypes.begin(), mimeTypes.end(),
+                        mimeType) != mimeTypes.end();
+            });
+    if (offered == self->offered_.end())
+    {
+        close(fd);
+        return;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    if (offered->writer_)
+    {
+        try
+        {
+            offered->writer_(fd);
+        }
+        catch (const std::runtime_error &err)
+        {
+            std::cerr << "Failed to send the selection: " << err.what()
+                << std::endl;
+        }
+        close(fd);
+        return;
+    }
+    const char *buf = offered->data_.data();
+    size_t left = offered->data_.size();
+    while (left > 0)
+    {
+        const ssize_t written = write(fd, buf, left);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            break; // The receiver went away, that's its problem
+        }
+        buf += written;
+        left -= written;
+    }
+    close(fd);
+}
+
+void
+DataControl::onCancelled(void *data, zwlr_data_control_source_v1 *)
+{
+    static_cast<DataControl *>(data)->dropSource();
+}
+
+void
+DataControl::dropSource()
+{
+    if (source_)
+        zwlr_data_control_source_v1_destroy(source_);
+    source_ = nullptr;
+    offered_ = {};
+}
+
+void
+DataControl::offer(std::vector<OfferedData> data)
+{
+    if (device_ == nullptr)
+        throw std::runtime_error("The seat is gone!");
+    dropSource();
+
+    offered_ = std::move(data);
+    source_ = zwlr_data_control_manager_v1_create_data_source(manager_);
+    zwlr_data_control_source_v1_add_listener(source_, &sourceListener_, this);
+    for (const OfferedData &offered : offered_)
+    {
+        for (const std::string &mimeType : offered.mimeTypes_)
+            zwlr_data_control_source_v1_offer(source_, mimeType.c_str());
+    }
+    zwlr_data_control_device_v1_set_selection(device_, source_);
+
+    // Once the compositor answers, the selection is ours
+    if (wl_display_roundtrip(display_) < 0)
+        throw std::runtime_error("Lost the connection to the compositor!");
+}
+
+void
+DataControl::serve()
+{
+    while (offering())
+    {
+        if (wl_display_dispatch(display_) < 0)
+            throw std::runtime_error("Lost the connection to the compositor!");
+    }
+}
+
+void
+DataControl::watch(const SelectionHandler &onNewSelection)
+{
+    onNewSelection_ = onNewSelection;
+}
+
+int
+DataControl::receive(const std::string &mimeType, const bool primary)
+{
+    zwlr_data_control_offer_v1 *offer = primary ? primarySelection_ :
+        selection_;
+    if (offer == nullptr)
+        throw std::runtime_error("There is no selection to receive!");
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        throw std::runtime_error("Failed to create a pipe!");
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    // The write end gets duplicated when the request is sent
+    zwlr_data_control_offer_v1_receive(offer, mimeType.c_str(), fds[1]);
+    wl_display_flush(display_);
+    close(fds[1]);
+    return fds[0];
+}
+
+int
+DataControl::fd() const
+{
+    return wl_display_get_fd(display_);
+}
+
+void
+DataControl::flush()
+{
+    wl_display_dispatch_pending(display_);
+    wl_display_flush(display_);
+}
+
+bool
+DataControl::dispatch()
+{
+    if (wl_display_dispatch(display_) < 0)
+        return false;
+    wl_display_flush(display_);
+    return device_ != nullptr;
+}
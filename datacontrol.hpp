@@ -0,0 +1,120 @@
+#ifndef __WLCLIPMGR_DATACONTROL_HPP
+#define __WLCLIPMGR_DATACONTROL_HPP
+
+#include <span>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+struct wl_display;
+struct wl_registry;
+struct wl_seat;
+struct zwlr_data_control_manager_v1;
+struct zwlr_data_control_device_v1;
+struct zwlr_data_control_source_v1;
+struct zwlr_data_control_offer_v1;
+struct wl_registry_listener;
+struct zwlr_data_control_device_v1_listener;
+struct zwlr_data_control_source_v1_listener;
+struct zwlr_data_control_offer_v1_listener;
+
+// Data offered under one or more mime types. Not copied, data_ has to
+// stay valid while it is offered. If set, writer_ writes the data to the
+// fd instead (data, that is not in memory as a whole).
+struct OfferedData
+{
+    std::vector<std::string> mimeTypes_;
+    std::span<const char> data_;
+    std::function<void(int)> writer_;
+};
+
+/*
+    Wayland client for the wlr-data-control protocol, which lets a
+    clipboard manager set the selection without having a surface.
+    Replaces spawning wl-copy: the data is served from memory, for every
+    mime type it is offered as. And wl-paste -w: new selections are
+    reported to a handler, which can receive them through pipes.
+*/
+class DataControl
+{
+    wl_display *display_ = nullptr;
+    wl_registry *registry_ = nullptr;
+    wl_seat *seat_ = nullptr;
+    zwlr_data_control_manager_v1 *manager_ = nullptr;
+    zwlr_data_control_device_v1 *device_ = nullptr;
+
+    zwlr_data_control_source_v1 *source_ = nullptr;
+    std::vector<OfferedData> offered_;
+
+    public:
+    // Called with the mime types of a new (primary) selection
+    using SelectionHandler = std::function<void(
+            const std::vector<std::string> &mimeTypes, bool primary)>;
+
+    private:
+    SelectionHandler onNewSelection_;
+    // Mime types of the offers of other clients
+    std::unordered_map<zwlr_data_control_offer_v1 *,
+        std::vector<std::string>> offers_;
+    zwlr_data_control_offer_v1 *selection_ = nullptr;
+    zwlr_data_control_offer_v1 *primarySelection_ = nullptr;
+
+    static const wl_registry_listener registryListener_;
+    static const zwlr_data_control_device_v1_listener deviceListener_;
+    static const zwlr_data_control_source_v1_listener sourceListener_;
+    static const zwlr_data_control_offer_v1_listener offerListener_;
+
+    static void onGlobal(void *data, wl_registry *registry, uint32_t name,
+            const char *interface, uint32_t version);
+    static void onGlobalRemove(void *data, wl_registry *registry,
+            uint32_t name);
+    static void onDataOffer(void *data, zwlr_data_control_device_v1 *device,
+            zwlr_data_control_offer_v1 *offer);
+    static void onSelection(void *data, zwlr_data_control_device_v1 *device,
+            zwlr_data_control_offer_v1 *offer);
+    static void onPrimarySelection(void *data,
+            zwlr_data_control_device_v1 *device,
+            zwlr_data_control_offer_v1 *offer);
+    static void onOffer(void *data, zwlr_data_control_offer_v1 *offer,
+            const char *mimeType);
+    static void onFinished(void *data, zwlr_data_control_device_v1 *device);
+    static void onSend(void *data, zwlr_data_control_source_v1 *source,
+            const char *mimeType, int32_t fd);
+    static void onCancelled(void *data, zwlr_data_control_source_v1 *source);
+
+    void dropSource();
+    void disconnect();
+    void setSelection(zwlr_data_control_offer_v1 *&current,
+            zwlr_data_control_offer_v1 *offer, const bool primary);
+
+    public:
+    // Connects to the compositor, throws if it lacks wlr-data-control
+    DataControl();
+    ~DataControl();
+    DataControl(const DataControl &) = delete;
+    DataControl &operator=(const DataControl &) = delete;
+
+    // Sets the selection to data, each offered under its mime types
+    void offer(std::vector<OfferedData> data);
+    // Whether the selection still is ours
+    bool offering() const noexcept { return source_ != nullptr; }
+    // Handles paste requests, until someone else sets the selection
+    void serve();
+
+    // Report new selections to onNewSelection, from the next dispatch on
+    void watch(const SelectionHandler &onNewSelection);
+    // Asks the client offering the current (primary) selection to write
+    // it as mimeType to a pipe. Returns the non blocking read end.
+    int receive(const std::string &mimeType, const bool primary);
+
+    // For polling along with other fds
+    int fd() const;
+    // Handles queued events and sends pending requests, call before polling
+    void flush();
+    // Reads and handles events, once fd() is readable.
+    // Returns false, when the compositor is gone.
+    bool dispatch();
+};
+
+#endif // __WLCLIPMGR_DATACONTROL_HPP
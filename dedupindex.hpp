@@ -0,0 +1,41 @@
+#ifndef __WLCLIPMGR_DEDUPINDEX_HPP
+#define __WLCLIPMGR_DEDUPINDEX_HPP
+
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+
+#include "contenthash.hpp"
+
+// Where the data of an entry is stored
+struct EntryRef
+{
+    std::string page_;
+    uint64_t id_;
+};
+
+/*
+    Content hash -> entry, across pages.
+    Lets a page reference the data of an entry in an older page, instead
+    of storing another copy of it.
+*/
+class DedupIndex
+{
+    std::unordered_map<ContentHash, EntryRef, ContentHashHasher> refs_;
+
+    public:
+    void add(const ContentHash &hash, const EntryRef &ref)
+    {
+        refs_.insert_or_assign(hash, ref);
+    }
+
+    const EntryRef *find(const ContentHash &hash) const
+    {
+        const auto it = refs_.find(hash);
+        return it == refs_.end() ? nullptr : &it->second;
+    }
+
+    size_t size() const noexcept { return refs_.size(); }
+};
+
+#endif // __WLCLIPMGR_DEDUPINDEX_HPP
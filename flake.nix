@@ -15,8 +15,11 @@
         msgpack-cxx
         gpgme
         libgpg-error
+        libgcrypt
         magic-enum
-        procps
+        wayland
+        wayland-scanner
+        zstd
       ];
     in
     {
@@ -1,55 +1,204 @@
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
 #include <gpgme++/context.h>
 #include <gpgme++/global.h>
 #include <gpgme++/encryptionresult.h>
 #include <gpgme++/decryptionresult.h>
 
 #include "gpgmeinterface.hpp"
+#include "trace.hpp"
 
-GpgMEInterface::GpgMEInterface(const std::string &gpgKeyUserName) :
-    gpgKeyUserName{gpgKeyUserName}
+// Has to happen before anything else of gpgme is used
+static void
+initializeGpgme()
 {
-    GpgME::initializeLibrary();
-    GpgME::EngineInfo info = GpgME::engineInfo(GpgME::Protocol::OpenPGP);
-    if (info.isNull())
-        throw std::runtime_error("No default gpg engine for OpenPGP!");
+    static const bool initialized = []()
+    {
+        GpgME::initializeLibrary();
+        GpgME::EngineInfo info = GpgME::engineInfo(GpgME::Protocol::OpenPGP);
+        if (info.isNull())
+            throw std::runtime_error("No default gpg engine for OpenPGP!");
+        return true;
+    }();
+    (void)initialized;
+}
+
+// -1 until looked at. Shared by the sessions of all threads.
+static std::atomic<int64_t> currentKeyringStamp{-1};
+
+GpgMEInterface::GpgMEInterface(const std::string &gpgKeyUserName,
+        const fs::path &keyCachePath) :
+    gpgKeyUserName{gpgKeyUserName}, keyCachePath_{keyCachePath}
+{
+    TraceSpan span{"gpgInit"};
+    initializeGpgme();
 
     context_ = GpgME::Context::create(GpgME::Protocol::OpenPGP);
     if (!context_)
         throw std::runtime_error("Failed to set up the gpg api!");
 
+    keyringStamp_ = keyringStamp();
     getKey();
 }
 
+const GpgMEInterface &
+GpgMEInterface::session(const std::string &gpgKeyUserName,
+        const fs::path &keyCachePath)
+{
+    thread_local std::map<std::string, std::unique_ptr<GpgMEInterface>>
+        sessions;
+    std::unique_ptr<GpgMEInterface> &session = sessions[gpgKeyUserName];
+    if (!session || session->keyringStamp_ != keyringStamp())
+        session = std::make_unique<GpgMEInterface>(gpgKeyUserName,
+                keyCachePath);
+    return *session;
+}
+
+int64_t
+GpgMEInterface::keyringStamp()
+{
+    int64_t res = currentKeyringStamp;
+    if (res >= 0)
+        return res;
+    initializeGpgme();
+    const char *homeDir = GpgME::dirInfo("homedir");
+    res = 0;
+    if (homeDir == NULL)
+    {
+        currentKeyringStamp = res;
+        return res;
+    }
+    for (const char *name : {"pubring.kbx", "pubring.gpg", "secring.gpg",
+            "private-keys-v1.d"})
+    {
+        std::error_code ec;
+        const auto writeTime = fs::last_write_time(fs::path{homeDir} / name,
+                ec);
+        if (!ec)
+            res = std::max<int64_t>(res, writeTime.time_since_epoch().count());
+    }
+    currentKeyringStamp = res;
+    return res;
+}
+
+void
+GpgMEInterface::refreshKeyringStamp() noexcept
+{
+    currentKeyringStamp = -1;
+}
+
+/*
+    gpgme writes its output through this straight into the callers
+    buffer, instead of into a GpgME::Data of its own, that would have to
+    be copied out again.
+*/
+class BufferDataProvider : public GpgME::DataProvider
+{
+    std::vector<char> &buffer_;
+    size_t offset_ = 0;
+
+    public:
+    explicit BufferDataProvider(std::vector<char> &buffer) : buffer_{buffer} {}
+
+    bool isSupported(const Operation op) const override
+    {
+        return op != Release;
+    }
+
+    ssize_t read(void *buf, const size_t size) override
+    {
+        const size_t toRead = std::min(size, buffer_.size() - offset_);
+        std::memcpy(buf, buffer_.data() + offset_, toRead);
+        offset_ += toRead;
+        return toRead;
+    }
+
+    ssize_t write(const void *buf, const size_t size) override
+    {
+        const char *bytes = static_cast<const char *>(buf);
+        if (offset_ == buffer_.size())
+        {
+            buffer_.insert(buffer_.end(), bytes, bytes + size);
+            offset_ += size;
+            return size;
+        }
+        if (offset_ + size > buffer_.size())
+            buffer_.resize(offset_ + size);
+        std::memcpy(buffer_.data() + offset_, bytes, size);
+        offset_ += size;
+        return size;
+    }
+
+    off_t seek(const off_t offset, const int whence) override
+    {
+        const off_t base = whence == SEEK_SET ? 0 :
+            whence == SEEK_CUR ? offset_ : buffer_.size();
+        if (base + offset < 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        offset_ = base + offset;
+        return offset_;
+    }
+
+    void release() override {}
+};
+
 std::vector<char>
-GpgMEInterface::encrypt(const char *buf,
-        const size_t size) const
+GpgMEInterface::encrypt(const char *buf, const size_t size) const
+{
+    std::vector<char> res;
+    encrypt(buf, size, res);
+    return res;
+}
+
+void
+GpgMEInterface::encrypt(const char *buf, const size_t size,
+        std::vector<char> &res) const
 {
-    const GpgME::Data toEncrypt{buf, size};
-    GpgME::Data res;
+    TraceSpan span{"gpgEncrypt"};
+    // Not copied, gpgme reads buf directly
+    const GpgME::Data toEncrypt{buf, size, false};
+    res.clear();
+    res.reserve(size + GPG_OVERHEAD_ESTIMATE);
+    BufferDataProvider provider{res};
+    GpgME::Data resData{&provider};
 
     GpgME::EncryptionResult encryptRes = context_->encrypt(
             std::vector<GpgME::Key>{key_},
             toEncrypt,
-            res,
+            resData,
             GpgME::Context::EncryptionFlags::None
     );
     throwIfError(encryptRes.error(), "Encrypting data failed!");
-    const size_t resSize = res.toString().size();
 
-    if (res.type() != GpgME::Data::Type::PGPEncrypted)
+    resData.seek(0, SEEK_SET);
+    if (resData.type() != GpgME::Data::Type::PGPEncrypted)
         std::cout << "Encrypted data has unexpected type!" << std::endl;
-
-    std::vector<char> resData(resSize);
-    res.read(resData.data(), resSize);
-
-    return resData;
 }
 
 std::vector<char>
 GpgMEInterface::decrypt(const char *buf, const size_t size) const
 {
-    const GpgME::Data toDecrypt{buf, size};
-    GpgME::Data res;
+    std::vector<char> res;
+    decrypt(buf, size, res);
+    return res;
+}
+
+void
+GpgMEInterface::decrypt(const char *buf, const size_t size,
+        std::vector<char> &res) const
+{
+    TraceSpan span{"gpgDecrypt"};
+    const GpgME::Data toDecrypt{buf, size, false};
 
     if (toDecrypt.type() != GpgME::Data::Type::PGPEncrypted)
     {
@@ -57,21 +206,24 @@ GpgMEInterface::decrypt(const char *buf, const size_t size) const
         std::cout << std::endl;
     }
 
-    GpgME::DecryptionResult decryptRes = context_->decrypt(toDecrypt, res);
+    // gpg compresses, so this is only a first guess
+    res.clear();
+    res.reserve(size);
+    BufferDataProvider provider{res};
+    GpgME::Data resData{&provider};
+    GpgME::DecryptionResult decryptRes = context_->decrypt(toDecrypt, resData);
     throwIfError(decryptRes.error(), "Decrypting data failed!");
-    const size_t resSize = res.toString().size();
-
-    std::vector<char> resData(resSize);
-    res.read(resData.data(), resSize);
-
-    return resData;
 }
 
 void
 GpgMEInterface::getKey()
 {
-    GpgME::Error err;
+    TraceSpan span{"gpgGetKey"};
     context_->setKeyListMode(GpgME::KeyListMode::WithSecret);
+    if (getCachedKey())
+        return;
+
+    GpgME::Error err;
     err = context_->startKeyListing();
     throwIfError(err, "Gpg key listing failed!");
 
@@ -107,6 +259,77 @@ GpgMEInterface::getKey()
     {
         throw std::runtime_error("Did not find a valid key!");
     }
+    context_->endKeyListing();
+    cacheKey();
+}
+
+// Looking up a single key is a lot cheaper, than listing the keyring.
+// The cached fingerprint is only trusted, as long as the keyring did not
+// change.
+bool
+GpgMEInterface::getCachedKey()
+{
+    if (keyCachePath_.empty())
+        return false;
+    std::ifstream cacheFile{keyCachePath_};
+    std::string line;
+    while (std::getline(cacheFile, line))
+    {
+        std::stringstream ss{line};
+        int64_t stamp;
+        std::string fingerprint;
+        if (!(ss >> stamp >> fingerprint) || stamp != keyringStamp_)
+            continue;
+        std::string userName;
+        std::getline(ss >> std::ws, userName);
+        if (userName != gpgKeyUserName)
+            continue;
+
+        GpgME::Error err;
+        const GpgME::Key key = context_->key(fingerprint.c_str(), err);
+        if (err || key.isNull() || !key.canEncrypt() || !key.hasSecret())
+            return false;
+        key_ = key;
+        return true;
+    }
+    return false;
+}
+
+void
+GpgMEInterface::cacheKey() const
+{
+    if (keyCachePath_.empty() || key_.primaryFingerprint() == NULL)
+        return;
+
+    // Keep the entries of other user names
+    std::stringstream res;
+    std::ifstream cacheFile{keyCachePath_};
+    std::string line;
+    while (std::getline(cacheFile, line))
+    {
+        std::stringstream ss{line};
+        int64_t stamp;
+        std::string fingerprint, userName;
+        if (!(ss >> stamp >> fingerprint))
+            continue;
+        std::getline(ss >> std::ws, userName);
+        if (userName != gpgKeyUserName)
+            res << line << '\n';
+    }
+    cacheFile.close();
+    res << keyringStamp_ << ' ' << key_.primaryFingerprint() << ' '
+        << gpgKeyUserName << '\n';
+
+    const fs::path tmpPath{keyCachePath_.string() + "." +
+        std::to_string(gettid())};
+    std::ofstream outFile{tmpPath};
+    outFile << res.str();
+    outFile.close();
+    std::error_code ec;
+    if (outFile)
+        fs::rename(tmpPath, keyCachePath_, ec);
+    else
+        fs::remove(tmpPath, ec);
 }
 
 bool
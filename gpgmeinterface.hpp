@@ -1,26 +1,55 @@
 #ifndef __WLCLIPMGR_GPGME_AGENT_HPP
 #define __WLCLIPMGR_GPGME_AGENT_HPP
 
+#include <filesystem>
+namespace fs = std::filesystem;
+
 #include <gpgme++/context.h>
 #include <gpgme++/data.h>
 #include <gpgme++/key.h>
 #include <gpgme++/keylistresult.h>
 #include <gpgme++/engineinfo.h>
 
+#define GPG_KEY_CACHE_FILE "gpgkey"
+#define GPG_OVERHEAD_ESTIMATE 0x400 // packet headers, session key, mdc
+
 class GpgMEInterface
 {
     const std::string gpgKeyUserName;
+    // Fingerprints of the keys used before: "<keyring stamp> <fpr> <user>"
+    const fs::path keyCachePath_;
+    int64_t keyringStamp_;
 
     void getKey();
+    bool getCachedKey();
+    void cacheKey() const;
     bool findUserNameInKey(const GpgME::Key &currKey,
             const std::string &userName) const noexcept;
     void throwIfError(const GpgME::Error &err, const std::string &msg) const;
 
     public:
-    GpgMEInterface(const std::string &gpgKeyUserName);
+    GpgMEInterface(const std::string &gpgKeyUserName,
+            const fs::path &keyCachePath = {});
+
+    // One instance per key user name and thread, so the context and key
+    // are set up once (and pages can be decrypted on several threads).
+    // It gets replaced, when the keyring changed since.
+    static const GpgMEInterface &session(const std::string &gpgKeyUserName,
+            const fs::path &keyCachePath);
+    // Newest modification of the keyring files. Only looked at once,
+    // until refreshKeyringStamp.
+    static int64_t keyringStamp();
+    // Look at the keyring again, the daemon does before every store
+    static void refreshKeyringStamp() noexcept;
 
     std::vector<char> encrypt(const char *buf, const size_t size) const;
     std::vector<char> decrypt(const char *buf, const size_t size) const;
+    // Write the result into res, so a buffer can be reused. buf is read
+    // in place.
+    void encrypt(const char *buf, const size_t size,
+            std::vector<char> &res) const;
+    void decrypt(const char *buf, const size_t size,
+            std::vector<char> &res) const;
 
     protected:
     std::unique_ptr<GpgME::Context> context_;
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "ingest.hpp"
+
+void
+Ingest::grow(const size_t minFree)
+{
+    // One byte past maxSize_ is enough to know it is too big
+    const size_t limit = maxSize_ + 1;
+    const size_t wanted = std::max(size_ + minFree, buffer_.size() * 2);
+    buffer_.resize(std::min(wanted, limit));
+}
+
+void
+Ingest::expect(const size_t sizeHint)
+{
+    if (sizeHint > buffer_.size())
+        grow(sizeHint - size_);
+}
+
+void
+Ingest::expectFrom(const int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        expect(st.st_size);
+        return;
+    }
+    // Pipe or socket: at least what is buffered already
+    int pending = 0;
+    if (ioctl(fd, FIONREAD, &pending) == 0 && pending > 0)
+        expect(pending);
+}
+
+bool
+Ingest::readSome(const int fd)
+{
+    while (!done_)
+    {
+        if (buffer_.size() - size_ < INGEST_MIN_READ &&
+                buffer_.size() <= maxSize_)
+            grow(INGEST_MIN_READ);
+
+        const ssize_t got = read(fd, buffer_.data() + size_,
+                buffer_.size() - size_);
+        if (got < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            throw std::runtime_error(std::string{"Failed to read the selection: "}
+                    + std::strerror(errno));
+        }
+        if (got == 0)
+        {
+            done_ = true;
+            break;
+        }
+
+        hasher_.update(buffer_.data() + size_, got);
+        size_ += got;
+        if (size_ > maxSize_)
+        {
+            // Don't bother reading the rest
+            tooBig_ = true;
+            done_ = true;
+            buffer_ = {};
+        }
+    }
+    return true;
+}
+
+std::vector<char>
+Ingest::take()
+{
+    buffer_.resize(size_);
+    size_ = 0;
+    return std::move(buffer_);
+}
+
+void
+Ingest::readAll(const int fd, const int timeoutMs)
+{
+    expectFrom(fd);
+    while (!readSome(fd))
+    {
+        // fd is non blocking, wait for more
+        pollfd pfd{fd, POLLIN, 0};
+        const int ready = poll(&pfd, 1, timeoutMs);
+        if (ready == 0)
+            throw std::runtime_error("Timed out reading the selection!");
+        if (ready < 0 && errno != EINTR)
+            throw std::runtime_error("Failed to wait for the selection!");
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef __WLCLIPMGR_INGEST_HPP
+#define __WLCLIPMGR_INGEST_HPP
+
+#include <span>
+#include <string>
+#include <vector>
+
+#include "contenthash.hpp"
+
+#define INGEST_MIN_READ 0x10000
+
+/*
+    Reads a selection from a fd (stdin, the daemon socket, a pipe)
+    straight into the buffer, that ends up in the ClipboardEntry.
+    The data is hashed while it comes in, and reading stops as soon as
+    it exceeds maxSize.
+*/
+class Ingest
+{
+    const size_t maxSize_;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+    ContentHasher hasher_;
+    bool tooBig_ = false;
+    bool done_ = false;
+
+    void grow(const size_t minFree);
+
+    friend class ClipboardEntry;
+
+    public:
+    explicit Ingest(const size_t maxSize) : maxSize_{maxSize} {}
+
+    // Reserve for sizeHint bytes, or what fd is known to hold
+    void expect(const size_t sizeHint);
+    void expectFrom(const int fd);
+
+    // Reads what fd has to offer right now (works with O_NONBLOCK).
+    // Returns true, once there is nothing more to read.
+    bool readSome(const int fd);
+    // Reads until EOF. Throws, if fd has nothing for timeoutMs.
+    void readAll(const int fd, const int timeoutMs = -1);
+
+    // Hands out the data read so far
+    std::vector<char> take();
+
+    // What was read so far, until it is taken
+    std::span<const char> data() const noexcept { return {buffer_.data(), size_}; }
+    bool done() const noexcept { return done_; }
+    bool tooBig() const noexcept { return tooBig_; }
+    size_t size() const noexcept { return size_; }
+};
+
+#endif // __WLCLIPMGR_INGEST_HPP
@@ -0,0 +1,194 @@
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "listing.hpp"
+#include "clipboard.hpp"
+
+#define PREVIEW_REPLACEMENT "█"
+
+// Length of the UTF-8 sequence at data, 0 if it is not a valid one and
+// -1 if it got cut off by the end of data
+static int
+utf8Length(const unsigned char *data, const size_t left)
+{
+    const unsigned char lead = data[0];
+    int length;
+    uint32_t min;
+    if (lead < 0x80)
+        return 1;
+    else if (lead >= 0xc2 && lead <= 0xdf)
+        length = 2, min = 0x80;
+    else if (lead >= 0xe0 && lead <= 0xef)
+        length = 3, min = 0x800;
+    else if (lead >= 0xf0 && lead <= 0xf4)
+        length = 4, min = 0x10000;
+    else
+        return 0;
+
+    uint32_t codePoint = lead & (0x3f >> (length - 1));
+    for (int i = 1; i < length; i++)
+    {
+        if (static_cast<size_t>(i) >= left)
+            return -1;
+        if ((data[i] & 0xc0) != 0x80)
+            return 0;
+        codePoint = (codePoint << 6) | (data[i] & 0x3f);
+    }
+    // Overlong, surrogate, beyond unicode or a C1 control character
+    if (codePoint < min || (codePoint >= 0xd800 && codePoint <= 0xdfff) ||
+            codePoint > 0x10ffff || (codePoint >= 0x80 && codePoint < 0xa0))
+        return 0;
+    return length;
+}
+
+std::string
+renderPreview(const std::string &mime, const size_t size,
+        const std::span<const char> start)
+{
+    // Everything but text is listed by mime and size only
+    if (!mime.empty() && mime != "text/plain")
+        return "mime: [" + mime + "], size: " + std::to_string(size);
+
+    const std::string suffix = "... (+" + std::to_string(size) + ")";
+    const size_t shortColumns = OUTPUT_LINE_TRUNCATE_AFTER - suffix.size();
+    std::string res;
+    size_t columns = 0;
+    size_t shortEnd = 0; // where res ends, if it has to be cut
+    size_t offset = 0;
+    const auto *data = reinterpret_cast<const unsigned char *>(start.data());
+    while (offset < start.size() && columns <= OUTPUT_LINE_TRUNCATE_AFTER)
+    {
+        const unsigned char c = data[offset];
+        int length = 1;
+        if (c == '\n')
+            res += "\\n", columns += 2;
+        else if (c == '\r')
+            res += "\\r", columns += 2;
+        else if (c == '\t')
+            res += "\\t", columns += 2;
+        else if (c < 0x20 || c == 0x7f)
+            res += PREVIEW_REPLACEMENT, columns++;
+        else
+        {
+            length = utf8Length(data + offset, start.size() - offset);
+            // Only the start of the data, the rest of it is not there
+            if (length < 0 && start.size() < size)
+                break;
+            if (length <= 0)
+            {
+                res += PREVIEW_REPLACEMENT;
+                length = 1;
+            }
+            else
+                res.append(start.data() + offset, length);
+            columns++;
+        }
+        offset += length;
+        if (columns <= shortColumns)
+            shortEnd = res.size();
+    }
+    if (offset == size && columns <= OUTPUT_LINE_TRUNCATE_AFTER)
+        return res;
+    res.resize(shortEnd);
+    return res + suffix;
+}
+
+ListFormat
+listFormatOf(const std::string &name)
+{
+    if (name == "text")
+        return ListFormat::text;
+    if (name == "nul")
+        return ListFormat::nul;
+    if (name == "json")
+        return ListFormat::json;
+    throw std::runtime_error("Unknown format " + name +
+            ", use text, nul or json");
+}
+
+static void
+appendJsonString(std::string &out, const std::string &str)
+{
+    static const char digits[] = "0123456789abcdef";
+    out += '"';
+    for (const char c : str)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            out += "\\u00";
+            out += digits[c >> 4];
+            out += digits[c & 0xf];
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+void
+ListRenderer::add(const ClipboardEntry &entry, const size_t index,
+        const std::string &page, const std::optional<size_t> number)
+{
+    if (format_ == ListFormat::json)
+    {
+        out_ += '{';
+        if (number)
+            out_ += "\"number\":" + std::to_string(*number) + ",";
+        if (!page.empty())
+        {
+            out_ += "\"page\":";
+            appendJsonString(out_, page);
+            out_ += ',';
+        }
+        out_ += "\"index\":" + std::to_string(index);
+        out_ += entry.pinned() ? ",\"pinned\":true" : ",\"pinned\":false";
+        out_ += ",\"mime\":";
+        appendJsonString(out_, entry.mime());
+        out_ += ",\"size\":" + std::to_string(entry.size());
+        out_ += ",\"timestamp\":" + std::to_string(entry.timestamp());
+        out_ += ",\"preview\":";
+        appendJsonString(out_, entry.preview());
+        out_ += "}\n";
+        return;
+    }
+
+    if (number)
+        out_ += std::to_string(*number) + " ";
+    if (!page.empty())
+        out_ += page + " ";
+    out_ += std::to_string(index) + " ";
+    if (entry.pinned())
+        out_ += "[pinned] ";
+    out_ += entry.preview();
+    out_ += format_ == ListFormat::nul ? '\0' : '\n';
+}
+
+void
+ListRenderer::write()
+{
+    // Whatever went through std::cout so far comes first
+    std::cout.flush();
+    const char *data = out_.data();
+    size_t left = out_.size();
+    while (left > 0)
+    {
+        const ssize_t written = ::write(STDOUT_FILENO, data, left);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break; // Whoever reads the listing went away
+        }
+        data += written;
+        left -= written;
+    }
+    out_.clear();
+}
@@ -0,0 +1,49 @@
+#ifndef __WLCLIPMGR_LISTING_HPP
+#define __WLCLIPMGR_LISTING_HPP
+
+#include <span>
+#include <string>
+#include <optional>
+#include <cstdint>
+
+#define OUTPUT_LINE_TRUNCATE_AFTER 0x36
+
+class ClipboardEntry;
+
+/*
+    The line an entry is listed as. Computed once, when the entry is
+    stored, and kept in the page index, so listing only copies it.
+    Text is escaped (\n, \r, \t, other control characters and invalid
+    UTF-8 as █) and cut after OUTPUT_LINE_TRUNCATE_AFTER characters,
+    everything else is listed by mime and size. start only has to hold
+    the beginning of the data, size is of all of it.
+*/
+std::string renderPreview(const std::string &mime, const size_t size,
+        const std::span<const char> start);
+
+enum class ListFormat
+{
+    text, // one line per entry
+    nul,  // like text, but each entry ends with \0 (fzf --read0)
+    json  // one JSON object per line
+};
+
+ListFormat listFormatOf(const std::string &name);
+
+// Collects a listing and writes it to stdout at once
+class ListRenderer
+{
+    const ListFormat format_;
+    std::string out_;
+
+    public:
+    explicit ListRenderer(const ListFormat format) : format_{format} {}
+
+    // page is only listed, if given. number counts through the pages.
+    void add(const ClipboardEntry &entry, const size_t index,
+            const std::string &page = "",
+            const std::optional<size_t> number = {});
+    void write();
+};
+
+#endif // __WLCLIPMGR_LISTING_HPP
@@ -1,16 +1,30 @@
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <algorithm>
+
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "clipboard.hpp"
+#include "daemon.hpp"
+#include "datacontrol.hpp"
+#include "trace.hpp"
+#include "pageset.hpp"
+#include "pagelock.hpp"
+#include "spool.hpp"
+#include "procblock.hpp"
 #include "thirdParty/argparse/include/argparse/argparse.hpp"
 
 std::string
-getDefaultPage()
+getPageName(const int daysAgo)
 {
     // Handle default page by setting it to date format clipddmmyy
     time_t now = std::time(0);
     tm *ltm = std::localtime(&now);
+    ltm->tm_mday -= daysAgo;
+    std::mktime(ltm);
     std::stringstream ss;
     std::string year{std::to_string(ltm->tm_year)};
     ss << "clip";
@@ -20,12 +34,23 @@ getDefaultPage()
     return ss.str();
 }
 
+std::string
+getDefaultPage()
+{
+    return getPageName(0);
+}
+
 enum Command
 {
     store,
     watch,
     list,
-    restore
+    restore,
+    stats,
+    search,
+    pin,
+    unpin,
+    prune
 };
 
 struct Args : public argparse::Args
@@ -34,6 +59,17 @@ struct Args : public argparse::Args
     std::string &page_ = kwarg("p,page", "clipboard page").set_default("");
     size_t &index_ = kwarg("i,index", "page index to restore").set_default(0);
     size_t &lines_ = kwarg("l,lines", "how many lines to list").set_default(10);
+    std::string &format_ = kwarg("format",
+        "list and search output: text, nul (\\0 separated) or json")
+        .set_default("text");
+    bool &all_ = flag("a,all", "list, search or restore over all pages");
+    size_t &days_ = kwarg("d,days",
+        "list, search or restore over the pages of the last days")
+        .set_default(0);
+    /*
+        Over several pages, list numbers the entries through all of them,
+        newest page first, and restore takes that number as index.
+    */
     std::string &block_ = kwarg("b,block",
         "Block saving the cliboard if a certain process is running.")
         .set_default("");
@@ -51,43 +87,387 @@ struct Args : public argparse::Args
        if not provided, the first key, that can encrypt and has a
        secret will be used. (to list your keys, use gpg(2) --list-keys))
     */
-    std::string programm_name_{};
+    bool &primary_ = flag("primary",
+        "Also store the primary selection, when watching.");
+    std::string &query_ = kwarg("q,query", "text to search for")
+        .set_default("");
+    bool &regex_ = flag("regex", "search query is an ECMAScript regex");
+    bool &ignoreCase_ = flag("ignore-case", "search ignoring case");
+    size_t &maxEntries_ = kwarg("max-entries",
+        "Keep at most this many entries per page.").set_default(0);
+    size_t &maxSize_ = kwarg("max-size",
+        "Keep at most this many MiB of entries per page.").set_default(0);
+    size_t &maxAge_ = kwarg("max-age",
+        "Drop entries and pages older than this many days.").set_default(0);
+    /*
+        0 means no limit. Pinned entries (pin -i index) are always kept.
+        The daemon enforces them on every copy and prunes old pages when
+        idle, otherwise store and prune do.
+    */
+    int &coalesceMs_ = kwarg("coalesce-ms",
+        "Store the selections of a burst together, when watching.")
+        .set_default(0);
+    bool &dropSuperseded_ = flag("drop-superseded",
+        "Only keep the last text of a burst, that grew by selecting.");
+    /*
+        Selections coming in within that many ms of the first one are
+        written to the page at once, repeated ones only once.
+    */
+    size_t &maxEntrySize_ = kwarg("max-entry-size",
+        "Don't store entries bigger than this many MiB.")
+        .set_default(MAX_SIZE_CLIPBOARD_ENTRY >> 20);
+    /*
+        Entries of 4 MiB and more are kept in blobs of their own (in
+        <cache>/blobs), so this can go up to hundreds of MiB.
+    */
+    std::string &fsync_ = kwarg("fsync",
+        "When to fsync pages: none, replace (new files only) or always.")
+        .set_default("replace");
+    std::string &trace_ = kwarg("trace",
+        "Write timings of all stages as Chrome trace JSON to this file.")
+        .set_default("");
+    bool &collectStats_ = flag("collect-stats",
+        "Add the timings of all stages to the stats the stats command prints.");
 };
 
-void doWatch(const Args &args)
-{
-    std::stringstream command;
-    command << "wl-paste -w " << args.programm_name_ << " store";
-    if (!args.page_.empty())
-        command << " --page " << args.page_;
-    if (!args.block_.empty())
-        command << " --block \"" << args.block_ << '\"';
-    if (args.notSecure_)
-        command << " --no-encryption";
-    std::system(command.str().c_str());
+RetentionPolicy
+retentionOf(const Args &args)
+{
+    RetentionPolicy res;
+    res.maxEntries_ = args.maxEntries_;
+    res.maxBytes_ = static_cast<uint64_t>(args.maxSize_) << 20;
+    res.maxAgeDays_ = args.maxAge_;
+    return res;
+}
+
+SyncPolicy
+syncPolicyOf(const Args &args)
+{
+    if (args.fsync_ == "none")
+        return SyncPolicy::none;
+    if (args.fsync_ == "replace")
+        return SyncPolicy::replace;
+    if (args.fsync_ == "always")
+        return SyncPolicy::always;
+    throw std::runtime_error("Unknown fsync policy: " + args.fsync_);
+}
+
+void doWatch(const Args &args, const fs::path &cacheDir)
+{
+    // The daemon keeps the page resident and receives new selections
+    // from the compositor. store invocations (scripts, wl-paste -w) only
+    // forward their stdin to it.
+    Daemon daemon{
+        cacheDir,
+        args.page_,
+        getDefaultPage,
+        args.gpgUserName_,
+        args.notSecure_,
+        args.block_,
+        retentionOf(args),
+        StoreBatching{args.coalesceMs_, args.dropSuperseded_}
+    };
+    daemon.watch(args.primary_);
+    daemon.run();
+}
+
+// The pages a command covers: all of them, those of the last days or
+// only the page
+std::vector<fs::path>
+selectPages(const Args &args, const fs::path &cacheDir,
+        const std::string &page)
+{
+    if (args.all_)
+        return findPages(cacheDir);
+    if (args.days_ == 0)
+        return {cacheDir / page};
+    std::vector<fs::path> res;
+    for (size_t day = 0; day < args.days_; day++)
+    {
+        const fs::path path = cacheDir / getPageName(day);
+        if (fs::exists(path.string() + ".idx"))
+            res.push_back(path);
+    }
+    return res;
+}
+
+bool
+spansPages(const Args &args)
+{
+    return args.all_ || args.days_ > 0;
+}
+
+void
+skipPage(const LoadedPage &loaded)
+{
+    std::cerr << "Skipping page " << loaded.path_.filename().string()
+        << ": " << loaded.error_ << std::endl;
+}
+
+void
+offerEntry(const ClipboardEntry &entry, std::function<void(int)> &&writer)
+{
+    std::vector<OfferedData> offered{{entry.mimeTypes(), entry.data(),
+        std::move(writer)}};
+    for (const EntryAlternative &alternative : entry.alternatives())
+        offered.push_back({{alternative.mime_}, alternative.data_.bytes()});
+
+    DataControl dataControl;
+    {
+        TraceSpan span{"offerSelection"};
+        dataControl.offer(std::move(offered));
+    }
+
+    // Like wl-copy, serve the selection in the background, until
+    // something else gets copied.
+    Tracer::instance().flush();
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("Failed to fork!");
+    if (pid > 0)
+        _exit(0); // The connection belongs to the child now
+
+    Tracer::instance().stop();
+    setsid();
+    std::signal(SIGPIPE, SIG_IGN);
+    const int devNull = open("/dev/null", O_RDWR);
+    dup2(devNull, STDIN_FILENO);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+    dataControl.serve();
+}
+
+void
+doRestore(const Args &args, Clipboard &clipboard)
+{
+    const ClipboardEntry *entry;
+    {
+        TraceSpan span{"restore"};
+        const PageLock lock{clipboard.pagePath()};
+        clipboard.loadPage();
+        entry = clipboard.restore(args.index_);
+    }
+    if (entry != nullptr)
+        offerEntry(*entry, clipboard.dataWriter(*entry));
 }
 
+// index_ counts through the pages, newest first
 void
-doCommand(const Args &args, Clipboard &clipboard)
+doRestorePages(const Args &args, const fs::path &cacheDir,
+        const std::string &page)
+{
+    std::unique_ptr<Clipboard> restoredPage;
+    const ClipboardEntry *entry = nullptr;
+    {
+        TraceSpan span{"restore"};
+        size_t index = args.index_;
+        const PageSet pages{selectPages(args, cacheDir, page),
+            args.gpgUserName_, args.notSecure_};
+        pages.forEach([](LoadedPage &) {}, [&](LoadedPage &loaded)
+            {
+                if (!loaded.page_)
+                {
+                    skipPage(loaded);
+                    return true;
+                }
+                if (index >= loaded.page_->size())
+                {
+                    index -= loaded.page_->size();
+                    return true;
+                }
+                restoredPage = std::move(loaded.page_);
+                const PageLock lock{restoredPage->pagePath()};
+                if (restoredPage->changedOnDisk())
+                    restoredPage->reloadPage();
+                // Only the front of the page stores go to is the selection
+                entry = restoredPage->restore(index,
+                        restoredPage->pageName() == page);
+                return false;
+            });
+    }
+    if (entry == nullptr)
+    {
+        if (!restoredPage)
+            std::cout << "Nothing to restore" << std::endl;
+        return;
+    }
+    offerEntry(*entry, restoredPage->dataWriter(*entry));
+}
+
+void
+doListPages(const Args &args, const fs::path &cacheDir,
+        const std::string &page)
+{
+    TraceSpan span{"list"};
+    size_t listed = 0;
+    ListRenderer renderer{listFormatOf(args.format_)};
+    const PageSet pages{selectPages(args, cacheDir, page), args.gpgUserName_,
+        args.notSecure_};
+    pages.forEach([](LoadedPage &) {}, [&](LoadedPage &loaded)
+        {
+            if (!loaded.page_)
+            {
+                skipPage(loaded);
+                return true;
+            }
+            const std::string pageName = loaded.page_->pageName();
+            for (size_t i = 0; i < loaded.page_->size(); i++)
+            {
+                if (listed == args.lines_)
+                    return false;
+                renderer.add(loaded.page_->entry(i), i, pageName, listed++);
+            }
+            return true;
+        });
+    renderer.write();
+}
+
+// Searches the text entries of the pages (all of them, unless -p or -d
+// is given), newest page first. Matches are printed with their page, so
+// they can be restored with -p and -i.
+void
+doSearch(const Args &args, const fs::path &cacheDir)
+{
+    if (args.query_.empty())
+        throw std::runtime_error("Nothing to search for, use -q");
+    TraceSpan span{"searchPages"};
+    const SearchQuery query{args.query_, args.regex_, args.ignoreCase_};
+    std::vector<fs::path> pagePaths = args.page_.empty() && !spansPages(args) ?
+        findPages(cacheDir) : selectPages(args, cacheDir, args.page_);
+
+    size_t found = 0;
+    ListRenderer renderer{listFormatOf(args.format_)};
+    const PageSet pages{std::move(pagePaths), args.gpgUserName_,
+        args.notSecure_};
+    pages.forEach([&](LoadedPage &loaded)
+        {
+            loaded.matches_ = loaded.page_->search(query);
+        },
+        [&](LoadedPage &loaded)
+        {
+            if (!loaded.page_)
+            {
+                skipPage(loaded);
+                return true;
+            }
+            for (const size_t i : loaded.matches_)
+            {
+                if (found++ == args.lines_)
+                    return false;
+                renderer.add(loaded.page_->entry(i), i,
+                        loaded.page_->pageName());
+            }
+            return true;
+        });
+    renderer.write();
+}
+
+void
+doCommand(const Args &args, const fs::path &cacheDir, Clipboard &clipboard)
 {
     switch(args.command_)
     {
         case Command::store:
+        {
+            TraceSpan span{"store"};
+            if (Daemon::forwardStore(Daemon::socketPath(cacheDir),
+                        args.page_, args.block_, args.gpgUserName_,
+                        args.notSecure_))
+                break;
+            if (!args.block_.empty() && isProcBlocking(args.block_))
+                break;
+
+            PageLock lock{clipboard.pagePath(), false};
+            StoreSpool spool{clipboard.pageName()};
+            Ingest selection{Clipboard::maxEntrySize()};
+            bool read = false;
+            bool queued = false;
+            // Queued copies are plaintext, so only for unencrypted pages
+            if (!lock.locked() && !clipboard.notSecure())
+                lock.wait();
+            else if (!lock.locked())
+            {
+                // Another store has the page, it adds this copy with its
+                // own. If it was done before we queued, we add it.
+                {
+                    TraceSpan readSpan{"readStdin"};
+                    selection.readAll(STDIN_FILENO);
+                }
+                read = true;
+                queued = spool.queue(selection);
+                lock.wait();
+                if (queued && spool.empty())
+                    break;
+            }
             clipboard.loadPage();
-            clipboard.addEntry(args.block_);
+            clipboard.setRetention(retentionOf(args));
+            if (!read)
+                clipboard.addEntry("");
+            else if (!queued)
+                clipboard.addEntry(std::move(selection), "");
+            spool.drain(clipboard);
             clipboard.writePage();
+            if (clipboard.needsCompaction())
+                clipboard.compactPage();
             break;
+        }
         case Command::list:
+        {
+            if (spansPages(args))
+            {
+                doListPages(args, cacheDir, clipboard.pageName());
+                break;
+            }
+            TraceSpan span{"list"};
+            ListRenderer renderer{listFormatOf(args.format_)};
             clipboard.loadPage();
-            clipboard.listEntries(args.lines_);
+            clipboard.listEntries(renderer, args.lines_);
+            renderer.write();
             break;
+        }
         case Command::restore:
-            clipboard.loadPage();
-            clipboard.restore(args.index_);
+            if (spansPages(args))
+                doRestorePages(args, cacheDir, clipboard.pageName());
+            else
+                doRestore(args, clipboard);
             break;
         case Command::watch:
-            doWatch(args);
+            doWatch(args, cacheDir);
             break;
+        case Command::stats:
+            printStats(cacheDir / TRACE_STATS_FILE);
+            break;
+        case Command::search:
+            doSearch(args, cacheDir);
+            break;
+        case Command::pin:
+        case Command::unpin:
+        {
+            const PageLock lock{clipboard.pagePath()};
+            clipboard.loadPage();
+            if (!clipboard.pin(args.index_, args.command_ == Command::pin))
+                throw std::runtime_error("No entry at that index!");
+            clipboard.writePage();
+            break;
+        }
+        case Command::prune:
+        {
+            TraceSpan span{"prune"};
+            const RetentionPolicy retention = retentionOf(args);
+            {
+                const PageLock lock{clipboard.pagePath()};
+                clipboard.loadPage();
+                if (clipboard.evict(retention) != 0)
+                    clipboard.writePage();
+                if (clipboard.needsCompaction())
+                    clipboard.compactPage();
+            }
+            // Takes the locks of the pages itself
+            pruneHistory(cacheDir, clipboard.pageName(), retention,
+                    args.gpgUserName_, args.notSecure_);
+            break;
+        }
     }
 }
 
@@ -116,7 +496,6 @@ main(int argc, char *argv[])
         fs::create_directory(cacheDir);
 
     auto args = argparse::parse<Args>(argc, argv);
-    args.programm_name_ = argv[0];
 
     std::string page;
     if (args.page_.empty())
@@ -127,19 +506,28 @@ main(int argc, char *argv[])
 
     Clipboard clipboard{
         cacheDir / page,
-        cacheDir / "tmpfile",
         args.gpgUserName_,
         args.notSecure_
     };
 
+    // Off by default, it rewrites the stats file on every invocation
+    if (args.collectStats_ && args.command_ != Command::stats)
+        Tracer::instance().collectStats(cacheDir / TRACE_STATS_FILE);
+    if (!args.trace_.empty())
+        Tracer::instance().traceTo(args.trace_);
+
+    int res = 0;
     try
     {
-        doCommand(args, clipboard);
+        PageLog::setSyncPolicy(syncPolicyOf(args));
+        Clipboard::setMaxEntrySize(args.maxEntrySize_ << 20);
+        doCommand(args, cacheDir, clipboard);
     }
     catch (const std::runtime_error &err)
     {
         std::cerr << err.what() << std::endl;
-        return -1;
+        res = -1;
     }
-    return 0;
+    Tracer::instance().flush();
+    return res;
 }
@@ -0,0 +1,43 @@
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mappedfile.hpp"
+
+MappedFile::MappedFile(const fs::path &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open " + path.string() + ": "
+                + std::strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Failed to stat " + path.string());
+    }
+    size_ = st.st_size;
+    inode_ = st.st_ino;
+    if (size_ == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    void *map = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        throw std::runtime_error("Failed to map " + path.string());
+    data_ = static_cast<const char *>(map);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr)
+        munmap(const_cast<char *>(data_), size_);
+}
@@ -0,0 +1,28 @@
+#ifndef __WLCLIPMGR_MAPPEDFILE_HPP
+#define __WLCLIPMGR_MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <sys/types.h>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+// Read-only mmap of a whole file. Pages are only faulted in when touched.
+class MappedFile
+{
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    ino_t inode_ = 0;
+
+    public:
+    explicit MappedFile(const fs::path &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const noexcept { return data_; }
+    size_t size() const noexcept { return size_; }
+    // Tells a file apart from one, that got renamed over it since
+    ino_t inode() const noexcept { return inode_; }
+};
+
+#endif // __WLCLIPMGR_MAPPEDFILE_HPP
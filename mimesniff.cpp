@@ -0,0 +1,232 @@
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "mimesniff.hpp"
+#include "trace.hpp"
+
+extern "C" {
+#include "thirdParty/xdgmime/src/xdgmime.h"
+}
+
+#define WORD_ONES 0x0101010101010101ull
+#define WORD_HIGH_BITS 0x8080808080808080ull
+#define MAGIC_LOOKAHEAD 0x100 // whitespace skipped, before giving up on magic
+
+static const std::string noMimeType;
+
+// Lookups by string_view, without making a std::string first
+struct MimeNameHasher
+{
+    using is_transparent = void;
+
+    size_t operator()(const std::string_view name) const noexcept
+    {
+        return std::hash<std::string_view>{}(name);
+    }
+};
+
+MimeType::MimeType() noexcept :
+    name_{&noMimeType}
+{
+}
+
+MimeType::MimeType(const std::string_view name) :
+    name_{&noMimeType}
+{
+    if (name.empty())
+        return;
+    static std::unordered_set<std::string, MimeNameHasher, std::equal_to<>>
+        names;
+    static std::mutex namesMutex;
+    std::lock_guard lock{namesMutex};
+    auto it = names.find(name);
+    if (it == names.end())
+        it = names.emplace(name).first;
+    // Nodes of the set never move
+    name_ = &*it;
+}
+
+static std::unordered_map<ContentHash, MimeType, ContentHashHasher> &
+mimeCache()
+{
+    static std::unordered_map<ContentHash, MimeType, ContentHashHasher> cache;
+    return cache;
+}
+
+// Pages get loaded (and seed the cache) on several threads
+static std::mutex mimeCacheMutex;
+
+void
+rememberMimeType(const ContentHash &hash, const MimeType mime)
+{
+    std::lock_guard lock{mimeCacheMutex};
+    auto &cache = mimeCache();
+    // Forgetting everything at once is good enough, the pages of the day
+    // seed it again
+    if (cache.size() >= MIME_CACHE_MAX)
+        cache.clear();
+    cache.insert_or_assign(hash, mime);
+}
+
+// Non-zero, if a byte of word is below n. Only exact for bytes < 0x80.
+static constexpr uint64_t
+hasByteBelow(const uint64_t word, const uint64_t n) noexcept
+{
+    return (word - WORD_ONES * n) & ~word & WORD_HIGH_BITS;
+}
+
+static bool
+isTextControl(const unsigned char c) noexcept
+{
+    return (c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' &&
+            c != '\v') || c == 0x7f;
+}
+
+// Length of the UTF-8 sequence at data, 0 if it is invalid
+static size_t
+utf8SequenceLength(const unsigned char *data, const size_t left) noexcept
+{
+    const unsigned char lead = data[0];
+    size_t length;
+    uint32_t codePoint;
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        length = 2;
+        codePoint = lead & 0x1f;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        length = 3;
+        codePoint = lead & 0x0f;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        length = 4;
+        codePoint = lead & 0x07;
+    }
+    else
+        return 0;
+    if (length > left)
+        return 0;
+
+    for (size_t i = 1; i < length; i++)
+    {
+        if ((data[i] & 0xc0) != 0x80)
+            return 0;
+        codePoint = (codePoint << 6) | (data[i] & 0x3f);
+    }
+    // Overlong encodings, surrogates and beyond unicode
+    if ((length == 3 && codePoint < 0x800) ||
+            (length == 4 && (codePoint < 0x10000 || codePoint > 0x10ffff)) ||
+            (codePoint >= 0xd800 && codePoint <= 0xdfff))
+        return 0;
+    return length;
+}
+
+bool
+isPlainText(const std::span<const char> data) noexcept
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(
+            data.data());
+    const size_t size = data.size();
+    size_t i = 0;
+    while (i < size)
+    {
+        // Eight bytes at a time, as long as they are printable ASCII:
+        // no high bit set and no byte below 0x20 (or 0x7f).
+        if (i + sizeof(uint64_t) <= size)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, sizeof(word));
+            const uint64_t notDel = word ^ (WORD_ONES * 0x7f);
+            if ((word & WORD_HIGH_BITS) == 0 &&
+                    hasByteBelow(word, 0x20) == 0 &&
+                    hasByteBelow(notDel, 0x01) == 0)
+            {
+                i += sizeof(word);
+                continue;
+            }
+        }
+
+        if (bytes[i] < 0x80)
+        {
+            if (isTextControl(bytes[i]))
+                return false;
+            i++;
+            continue;
+        }
+        const size_t length = utf8SequenceLength(bytes + i, size - i);
+        if (length == 0)
+            return false;
+        i += length;
+    }
+    return true;
+}
+
+// Text, that could be something more specific by its magic
+static bool
+mightHaveMagic(const std::span<const char> data) noexcept
+{
+    const auto end = data.begin() + std::min(data.size(),
+            (size_t)MAGIC_LOOKAHEAD);
+    const auto start = std::find_if(data.begin(), end, [](char c)
+            {
+                return c != ' ' && c != '\t' && c != '\n' && c != '\r';
+            });
+    if (start == end)
+        return false;
+    switch (*start)
+    {
+        case '<': // xml, html, svg
+        case '#': // scripts
+        case '%': // postscript, pdf
+        case '{': // rtf
+        case '[': // desktop files
+        case '@': // batch
+            return true;
+        default:
+            return false;
+    }
+}
+
+void
+preloadMimeDatabase()
+{
+    xdg_mime_get_max_buffer_extents();
+}
+
+MimeType
+sniffMimeType(const ContentHash &hash, const std::span<const char> data)
+{
+    {
+        std::lock_guard lock{mimeCacheMutex};
+        auto &cache = mimeCache();
+        const auto cached = cache.find(hash);
+        if (cached != cache.end())
+            return cached->second;
+    }
+
+    TraceSpan span{"setMimeType"};
+    MimeType res;
+    if (!data.empty() && !mightHaveMagic(data) && isPlainText(data))
+    {
+        static const MimeType plainText{"text/plain"};
+        res = plainText;
+    }
+    else
+    {
+        // Only the start of the data is looked at anyway
+        const size_t sniffSize = std::min(data.size(),
+                (size_t)xdg_mime_get_max_buffer_extents());
+        int prio;
+        res = MimeType{xdg_mime_get_mime_type_for_data(data.data(),
+                sniffSize, &prio)};
+    }
+    rememberMimeType(hash, res);
+    return res;
+}
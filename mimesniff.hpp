@@ -0,0 +1,59 @@
+#ifndef __WLCLIPMGR_MIMESNIFF_HPP
+#define __WLCLIPMGR_MIMESNIFF_HPP
+
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "contenthash.hpp"
+
+#define MIME_CACHE_MAX 0x2000 // content hashes remembered per process
+
+// An interned mime type. A page holds mostly the same few types, so
+// entries point to one shared string each, instead of a copy of their
+// own. Interned names live as long as the process.
+class MimeType
+{
+    const std::string *name_;
+
+    public:
+    MimeType() noexcept;
+    explicit MimeType(const std::string_view name);
+
+    const std::string &str() const noexcept { return *name_; }
+    operator const std::string &() const noexcept { return *name_; }
+    bool empty() const noexcept { return name_->empty(); }
+
+    bool operator==(const MimeType &other) const noexcept
+    {
+        return name_ == other.name_;
+    }
+    bool operator==(const std::string_view other) const noexcept
+    {
+        return *name_ == other;
+    }
+};
+
+/*
+    Mime type of new entries. Most copies are plain text, those are
+    recognized by validating them as UTF-8, without xdgmime (which first
+    has to load the shared-mime-info database in a new process).
+    Text that might start with a magic (<?xml, #!, %!PS, ...) still goes
+    to xdgmime.
+
+    Results are remembered per content hash, so copying something again
+    is never sniffed twice. Loaded pages seed the cache with the mime
+    types of their entries.
+*/
+MimeType sniffMimeType(const ContentHash &hash,
+        const std::span<const char> data);
+void rememberMimeType(const ContentHash &hash, const MimeType mime);
+
+// Loads the shared-mime-info database now, instead of on the first
+// entry that is not plain text
+void preloadMimeDatabase();
+
+// Valid UTF-8 without control characters other than whitespace
+bool isPlainText(const std::span<const char> data) noexcept;
+
+#endif // __WLCLIPMGR_MIMESNIFF_HPP
@@ -0,0 +1,105 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <mutex>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "pagelock.hpp"
+#include "trace.hpp"
+
+// Locks this process holds, with how many PageLocks share them
+static std::mutex heldMutex;
+static std::unordered_map<std::string, size_t> heldLocks;
+static pid_t heldPid = 0;
+
+// A forked child doesn't hold the locks of its parent
+static void
+forgetParentLocks()
+{
+    if (heldPid == getpid())
+        return;
+    heldLocks.clear();
+    heldPid = getpid();
+}
+
+bool
+PageLock::takeNested()
+{
+    const std::lock_guard<std::mutex> guard{heldMutex};
+    forgetParentLocks();
+    const auto it = heldLocks.find(path_.string());
+    if (it == heldLocks.end())
+        return false;
+    it->second++;
+    return true;
+}
+
+void
+PageLock::held()
+{
+    const std::lock_guard<std::mutex> guard{heldMutex};
+    forgetParentLocks();
+    heldLocks[path_.string()]++;
+    locked_ = true;
+}
+
+PageLock::PageLock(const fs::path &pagePath, const bool wait) :
+    path_{pagePath.string() + ".lock"}
+{
+    if (takeNested())
+    {
+        locked_ = true;
+        return;
+    }
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0)
+        throw std::runtime_error("Failed to open " + path_.string() + ": "
+                + std::strerror(errno));
+
+    int res;
+    while ((res = flock(fd_, LOCK_EX | LOCK_NB)) != 0 && errno == EINTR);
+    if (res != 0 && errno != EWOULDBLOCK)
+    {
+        close(fd_);
+        throw std::runtime_error("Failed to lock " + path_.string() + ": "
+                + std::strerror(errno));
+    }
+    if (res == 0)
+        held();
+    else if (wait)
+        this->wait();
+}
+
+PageLock::~PageLock()
+{
+    if (locked_)
+    {
+        const std::lock_guard<std::mutex> guard{heldMutex};
+        forgetParentLocks();
+        const auto it = heldLocks.find(path_.string());
+        if (it != heldLocks.end() && --it->second == 0)
+            heldLocks.erase(it);
+    }
+    // Closing drops the lock
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+void
+PageLock::wait()
+{
+    if (locked_)
+        return;
+    TraceSpan span{"waitPageLock"};
+    while (flock(fd_, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+            throw std::runtime_error("Failed to lock " + path_.string() +
+                    ": " + std::strerror(errno));
+    }
+    held();
+}
@@ -0,0 +1,38 @@
+#ifndef __WLCLIPMGR_PAGELOCK_HPP
+#define __WLCLIPMGR_PAGELOCK_HPP
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+/*
+    Advisory lock (flock) on a page, held while changing it. Readers don't
+    need it: appends only add complete records (a torn one at the end is
+    ignored) and rewrites replace the files with a rename.
+
+    The lock is on <page>.lock, the logs themselves get replaced. flock
+    locks belong to the open file, so locking a page the process holds the
+    lock of already doesn't take it again, the nested PageLock just shares
+    it.
+*/
+class PageLock
+{
+    const fs::path path_;
+    int fd_ = -1; // -1, if nested
+    bool locked_ = false;
+
+    bool takeNested();
+    void held();
+
+    public:
+    // Only tries to take the lock, unless wait
+    explicit PageLock(const fs::path &pagePath, const bool wait = true);
+    ~PageLock();
+    PageLock(const PageLock &) = delete;
+    PageLock &operator=(const PageLock &) = delete;
+
+    bool locked() const noexcept { return locked_; }
+    // Blocks until the lock is ours
+    void wait();
+};
+
+#endif // __WLCLIPMGR_PAGELOCK_HPP
@@ -0,0 +1,407 @@
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pagelog.hpp"
+#include "crc32c.hpp"
+
+std::vector<char>
+PageLog::makeHeader() const
+{
+    PageLogHeader header{};
+    std::memcpy(header.magic_, PAGE_LOG_MAGIC, sizeof(header.magic_));
+    header.version_ = PAGE_LOG_VERSION;
+    header.headerSize_ = sizeof(header) + PAGE_LOG_CHECKSUM_SIZE;
+    header.encryption_ = encryption_;
+    header.codec_ = codec_;
+
+    const char *headerBytes = reinterpret_cast<const char *>(&header);
+    std::vector<char> res(headerBytes, headerBytes + sizeof(header));
+    const uint32_t crc = crc32c(res.data(), res.size());
+    const char *crcBytes = reinterpret_cast<const char *>(&crc);
+    res.insert(res.end(), crcBytes, crcBytes + sizeof(crc));
+    return res;
+}
+
+// Appends header, payload and, if checksummed, the crc of both to out
+static void
+appendRecord(std::vector<char> &out, const RecordHeader &header,
+        const char *data, const bool checksummed)
+{
+    const size_t start = out.size();
+    const char *headerBytes = reinterpret_cast<const char *>(&header);
+    out.insert(out.end(), headerBytes, headerBytes + sizeof(header));
+    if (header.size_ > 0)
+        out.insert(out.end(), data, data + header.size_);
+    if (!checksummed)
+        return;
+    const uint32_t crc = crc32c(out.data() + start, out.size() - start);
+    const char *crcBytes = reinterpret_cast<const char *>(&crc);
+    out.insert(out.end(), crcBytes, crcBytes + sizeof(crc));
+}
+
+static bool
+checksumMatches(const char *data, const uint64_t size)
+{
+    uint32_t crc;
+    std::memcpy(&crc, data + size - sizeof(crc), sizeof(crc));
+    return crc32c(data, size - sizeof(crc)) == crc;
+}
+
+static void
+writeAll(const int fd, const char *data, size_t size, const fs::path &path)
+{
+    while (size > 0)
+    {
+        const ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Failed to write " + path.string() +
+                    ": " + std::strerror(errno));
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+// Write to a temporary file and rename it over path, so readers either
+// see the old or the new file.
+static void
+replaceFile(const fs::path &path, const char *data, const size_t size)
+{
+    std::string tmpPath = path.string() + ".XXXXXX";
+    const int fd = mkostemp(tmpPath.data(), O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Failed to create " + tmpPath + ": " +
+                std::strerror(errno));
+    const bool sync = PageLog::syncPolicy() != SyncPolicy::none;
+    try
+    {
+        writeAll(fd, data, size, tmpPath);
+        // Otherwise the rename might hit the disk before the data
+        if (sync && fsync(fd) != 0)
+            throw std::runtime_error("Failed to sync " + tmpPath);
+    }
+    catch (...)
+    {
+        close(fd);
+        std::error_code ec;
+        fs::remove(tmpPath, ec);
+        throw;
+    }
+    close(fd);
+    fs::rename(tmpPath, path);
+
+    if (!sync)
+        return;
+    const int dirFd = open(path.parent_path().c_str(),
+            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0)
+    {
+        fsync(dirFd);
+        close(dirFd);
+    }
+}
+
+// Iterates the complete records in data[start, size), returns where they
+// end. Checksums are verified, if the log has them and verify is set.
+static uint64_t
+forEachRecord(const char *data, const uint64_t start, const uint64_t size,
+        const bool checksummed, const bool verify, const fs::path &path,
+        const std::function<void(const LogRecord &)> &onRecord)
+{
+    const uint64_t trailer = checksummed ? PAGE_LOG_CHECKSUM_SIZE : 0;
+    uint64_t offset = start;
+    while (offset + sizeof(RecordHeader) <= size)
+    {
+        LogRecord record;
+        std::memcpy(&record.header_, data + offset, sizeof(RecordHeader));
+        const uint64_t end = offset + sizeof(RecordHeader) +
+            record.header_.size_ + trailer;
+        if (end > size)
+            break;
+        if (checksummed && verify &&
+                !checksumMatches(data + offset, end - offset))
+        {
+            // Torn, unless something got appended after it
+            if (end == size)
+                break;
+            throw std::runtime_error("Damaged record at " +
+                    std::to_string(offset) + " in " + path.string() + "!");
+        }
+
+        record.offset_ = offset;
+        record.payload_ = data + offset + sizeof(RecordHeader);
+        onRecord(record);
+        offset = end;
+    }
+    return offset;
+}
+
+bool
+PageLog::exists() const
+{
+    return fs::exists(path_);
+}
+
+void
+PageLog::reset() noexcept
+{
+    size_ = 0;
+    fileSize_ = 0;
+    inode_ = 0;
+    start_ = 0;
+    garbage_ = 0;
+    version_ = PAGE_LOG_VERSION;
+    pending_.clear();
+    map_.reset();
+}
+
+void
+PageLog::sawFile(const MappedFile &map) noexcept
+{
+    fileSize_ = map.size();
+    inode_ = map.inode();
+}
+
+void
+PageLog::sawFile()
+{
+    struct stat st;
+    if (stat(path_.c_str(), &st) != 0)
+        throw std::runtime_error("Failed to stat " + path_.string() + ": " +
+                std::strerror(errno));
+    fileSize_ = st.st_size;
+    inode_ = st.st_ino;
+}
+
+bool
+PageLog::changedOnDisk() const
+{
+    struct stat st;
+    if (stat(path_.c_str(), &st) != 0)
+        return inode_ != 0;
+    return st.st_ino != inode_ ||
+        static_cast<uint64_t>(st.st_size) != fileSize_;
+}
+
+const MappedFile &
+PageLog::map(const uint64_t minSize) const
+{
+    // Remap, if the log grew (or got replaced) since mapping it
+    if (!map_ || map_->size() < minSize)
+        map_ = std::make_shared<MappedFile>(path_);
+    if (map_->size() < minSize)
+        throw std::runtime_error(path_.string() + " is truncated!");
+    return *map_;
+}
+
+void
+PageLog::checkHeader(const MappedFile &map)
+{
+    PageLogHeader header;
+    std::memcpy(&header, map.data(), sizeof(header));
+    if (std::memcmp(header.magic_, PAGE_LOG_MAGIC, sizeof(header.magic_)) != 0)
+        throw std::runtime_error(path_.string() + " is not a page log!");
+    if (header.version_ > PAGE_LOG_VERSION)
+        throw std::runtime_error(path_.string() +
+                " was written by a newer wlclipmgr!");
+    version_ = header.version_;
+    if (!checksummed())
+    {
+        start_ = sizeof(header);
+        return;
+    }
+
+    // Newer versions might have a bigger header, that has the crc last
+    if (header.headerSize_ < sizeof(header) + PAGE_LOG_CHECKSUM_SIZE ||
+            header.headerSize_ > map.size() ||
+            !checksumMatches(map.data(), header.headerSize_))
+        throw std::runtime_error("The header of " + path_.string() +
+                " is damaged!");
+    start_ = header.headerSize_;
+}
+
+void
+PageLog::load(const std::function<void(const LogRecord &)> &onRecord)
+{
+    reset();
+    const MappedFile &logMap = map(0);
+    sawFile(logMap);
+    if (logMap.size() < sizeof(PageLogHeader))
+        return;
+    checkHeader(logMap);
+
+    size_ = forEachRecord(logMap.data(), start_, logMap.size(), checksummed(),
+            true, path_, onRecord);
+    if (size_ != logMap.size())
+        std::cerr << "Ignoring torn record at the end of "
+            << path_.string() << std::endl;
+}
+
+void
+PageLog::attach()
+{
+    reset();
+    if (!exists())
+        return;
+    const MappedFile &logMap = map(0);
+    sawFile(logMap);
+    if (logMap.size() < sizeof(PageLogHeader))
+        return;
+    checkHeader(logMap);
+    size_ = logMap.size();
+}
+
+void
+PageLog::scan(const std::function<void(const LogRecord &)> &onRecord) const
+{
+    if (size_ == 0)
+        return;
+    const MappedFile &logMap = map(size_);
+    forEachRecord(logMap.data(), start_, size_, checksummed(), false, path_,
+            onRecord);
+}
+
+uint64_t
+PageLog::append(const RecordType type, const uint64_t id,
+        const uint8_t flags, const char *data, const size_t size,
+        const uint16_t part)
+{
+    if (size > UINT32_MAX)
+        throw std::runtime_error("Record too big for the page log!");
+
+    if (size_ == 0 && pending_.empty())
+    {
+        // New log, in the current format
+        version_ = PAGE_LOG_VERSION;
+        pending_ = makeHeader();
+        start_ = pending_.size();
+    }
+
+    const uint64_t offset = size_ + pending_.size();
+    appendRecord(pending_, RecordHeader{static_cast<uint32_t>(size), type,
+            flags, part, id}, data, checksummed());
+    return offset;
+}
+
+void
+PageLog::flush()
+{
+    if (pending_.empty())
+        return;
+
+    if (size_ == 0)
+    {
+        replaceFile(path_, pending_.data(), pending_.size());
+        map_.reset();
+    }
+    else
+    {
+        struct stat st;
+        if (stat(path_.c_str(), &st) != 0 || st.st_ino != inode_ ||
+                static_cast<uint64_t>(st.st_size) < size_)
+            throw std::runtime_error(path_.string() +
+                    " got replaced by another process!");
+        const uint64_t fileSize = st.st_size;
+        if (fileSize > size_)
+        {
+            // Complete records after ours are another process', only a
+            // torn one (or one failing its checksum) may be cut off
+            const MappedFile &logMap = map(fileSize);
+            if (forEachRecord(logMap.data(), size_, fileSize, checksummed(),
+                        true, path_, [](const LogRecord &) {}) != size_)
+                throw std::runtime_error(path_.string() +
+                        " got appended to by another process!");
+            map_.reset();
+            fs::resize_file(path_, size_);
+        }
+
+        const int fd = open(path_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Failed to append to " + path_.string()
+                    + ": " + std::strerror(errno));
+        try
+        {
+            writeAll(fd, pending_.data(), pending_.size(), path_);
+            if (syncPolicy_ == SyncPolicy::always && fdatasync(fd) != 0)
+                throw std::runtime_error("Failed to sync " + path_.string());
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    }
+    size_ += pending_.size();
+    pending_.clear();
+    sawFile();
+}
+
+LogRecord
+PageLog::readRecord(const uint64_t offset, const bool verify) const
+{
+    if (offset < start_ || offset + sizeof(RecordHeader) > size_)
+        throw std::runtime_error("Record offset out of range!");
+
+    const MappedFile &logMap = map(size_);
+    LogRecord record;
+    std::memcpy(&record.header_, logMap.data() + offset, sizeof(RecordHeader));
+    const uint64_t end = offset + sizeof(RecordHeader) +
+        record.header_.size_ + (checksummed() ? PAGE_LOG_CHECKSUM_SIZE : 0);
+    if (end > size_)
+        throw std::runtime_error("Record exceeds " + path_.string());
+    if (checksummed() && verify &&
+            !checksumMatches(logMap.data() + offset, end - offset))
+        throw std::runtime_error("Damaged record at " +
+                std::to_string(offset) + " in " + path_.string() + "!");
+    record.offset_ = offset;
+    record.payload_ = logMap.data() + offset + sizeof(RecordHeader);
+    return record;
+}
+
+bool
+PageLog::needsCompaction() const noexcept
+{
+    return garbage_ > PAGE_LOG_COMPACT_MIN_GARBAGE && garbage_ > size_ / 4;
+}
+
+std::vector<uint64_t>
+PageLog::compact(const std::vector<uint64_t> &keepOffsets)
+{
+    flush();
+
+    // Read in the format of the log, written in the current one
+    std::vector<LogRecord> records;
+    records.reserve(keepOffsets.size());
+    for (const uint64_t offset : keepOffsets)
+        records.push_back(readRecord(offset));
+
+    std::vector<char> compacted = makeHeader();
+    const uint64_t start = compacted.size();
+    std::vector<uint64_t> newOffsets;
+    newOffsets.reserve(keepOffsets.size());
+    for (const LogRecord &record : records)
+    {
+        newOffsets.push_back(compacted.size());
+        appendRecord(compacted, record.header_, record.payload_, true);
+    }
+
+    replaceFile(path_, compacted.data(), compacted.size());
+    map_.reset();
+    sawFile();
+    version_ = PAGE_LOG_VERSION;
+    size_ = compacted.size();
+    start_ = start;
+    garbage_ = 0;
+    return newOffsets;
+}
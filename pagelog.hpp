@@ -0,0 +1,219 @@
+#ifndef __WLCLIPMGR_PAGELOG_HPP
+#define __WLCLIPMGR_PAGELOG_HPP
+
+#include <cstdint>
+#include <sys/types.h>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "mappedfile.hpp"
+
+#define PAGE_LOG_MAGIC "WLCPLOG"
+#define PAGE_LOG_VERSION 3
+#define PAGE_LOG_COMPACT_MIN_GARBAGE 0x10000
+
+/*
+    A page on disk consists of two append-only logs of records:
+
+        [file header][record header][payload][record header][payload]...
+
+    <page>.idx is the index: the session key, one meta record per entry
+    and promote/remove records. Replaying it from the start yields the
+    order and meta data of the page, without touching any entry data.
+    <page>.dat holds the entry data, one data record per entry, which is
+    only read (through a mmap) when the data is needed.
+
+    Storing an entry appends a data and a meta record, restoring appends a
+    payload-less promote record to the index, evicting a remove record.
+    Garbage (promote/remove/pin records and removed entries) is dropped,
+    when the page gets compacted.
+
+    <page>.tri holds the trigrams of the text entries for searching, it is
+    only read by search and can be rebuilt from the page any time.
+
+    From version 3 on, the file header says where the records start and
+    is followed by its crc32c, every record by the crc32c of its header
+    and payload. A damaged record fails loading the log (or reading the
+    record), instead of being decoded. A bad one at the end is a torn
+    append and ignored, like one that got cut short.
+
+    Logs of an older version are read as they are and appended to in
+    their format, they only get converted when they are rewritten
+    (compacted). So a new version does not have to rewrite every page.
+
+    Version 1 pages were a single log (<page>.log) of whole entry records,
+    version 2 logs have no checksums.
+*/
+
+enum class RecordType : uint8_t
+{
+    entry = 1,      // version 1 only, payload: see recordSplit
+    promote = 2,    // move entry id_ to the front
+    remove = 3,     // drop entry id_
+    sessionKey = 4, // payload: gpg encrypted SessionKey of the page
+    data = 5,       // payload: data of entry id_ (or an alternative)
+    meta = 6,       // payload: msgpack'ed meta data of entry id_
+    dictionary = 7, // payload: zstd dictionary of the page, id_ is its id
+                    // (none: training failed with id_ text entries)
+    trigrams = 8,   // payload: sorted Trigrams of the text of entry id_
+    pin = 9,        // keep entry id_ when evicting
+    unpin = 10      // entry id_ can be evicted again
+};
+
+enum RecordFlags : uint8_t
+{
+    recordGpgEncrypted = 0x1, // whole payload encrypted with gpg
+    recordSealed = 0x2, // parts sealed with the SessionKey of the page
+    // Entry payload is [u32 metaSize][meta][data], so the meta data can
+    // be read without touching the data. Otherwise it is a msgpack'ed
+    // ClipboardEntry.
+    recordSplit = 0x4,
+    recordCompressed = 0x8, // data records: zstd compressed, before sealing
+    recordTruncated = 0x10 // trigram records: only the start got indexed
+};
+
+// When page logs get fsync'ed
+enum class SyncPolicy : uint8_t
+{
+    none,    // leave it to the kernel
+    replace, // files replacing a page, so a crash can not leave it empty
+    always   // every append as well
+};
+
+// What the records of a log are, for anything reading the files.
+// Every record says itself, whether it is sealed or compressed.
+enum class LogEncryption : uint8_t
+{
+    none,
+    sessionKey // sealed with the SessionKey of the page
+};
+
+enum class LogCodec : uint8_t
+{
+    none,
+    zstd // records might be compressed
+};
+
+struct PageLogHeader
+{
+    char magic_[8];
+    uint32_t version_;
+    // Version 3 on, reserved before
+    uint16_t headerSize_; // records start here, the header crc before it
+    LogEncryption encryption_;
+    LogCodec codec_;
+};
+static_assert(sizeof(PageLogHeader) == 16);
+
+#define PAGE_LOG_CHECKSUM_SIZE 4 // crc32c after the header and each record
+#define PAGE_LOG_CHECKSUMS_SINCE 3 // version
+
+struct RecordHeader
+{
+    uint32_t size_; // of the payload
+    RecordType type_;
+    uint8_t flags_;
+    uint16_t part_; // data records: 0 entry data, n alternative n - 1
+    uint64_t id_;
+};
+static_assert(sizeof(RecordHeader) == 16);
+
+struct LogRecord
+{
+    RecordHeader header_;
+    uint64_t offset_; // of the record header in the log
+    const char *payload_;
+};
+
+class PageLog
+{
+    static inline SyncPolicy syncPolicy_ = SyncPolicy::replace;
+    const fs::path path_;
+    uint64_t size_ = 0; // valid bytes in the log file
+    // The file, as this process last saw it. Other processes append to
+    // it (or replace it) as well, while holding the PageLock.
+    uint64_t fileSize_ = 0;
+    ino_t inode_ = 0;
+    uint64_t start_ = 0; // of the first record
+    uint64_t garbage_ = 0;
+    uint32_t version_ = PAGE_LOG_VERSION;
+    LogEncryption encryption_ = LogEncryption::none;
+    LogCodec codec_ = LogCodec::none;
+    std::vector<char> pending_;
+    mutable std::shared_ptr<MappedFile> map_;
+
+    const MappedFile &map(const uint64_t minSize) const;
+    void checkHeader(const MappedFile &map);
+    bool checksummed() const noexcept
+    {
+        return version_ >= PAGE_LOG_CHECKSUMS_SINCE;
+    }
+    std::vector<char> makeHeader() const;
+    void sawFile(const MappedFile &map) noexcept;
+    void sawFile();
+
+    public:
+    explicit PageLog(const fs::path &path) : path_{path} {}
+
+    static void setSyncPolicy(const SyncPolicy policy) noexcept
+    {
+        syncPolicy_ = policy;
+    }
+    static SyncPolicy syncPolicy() noexcept { return syncPolicy_; }
+
+    // What goes into the header of new log files
+    void setContent(const LogEncryption encryption,
+            const LogCodec codec) noexcept
+    {
+        encryption_ = encryption;
+        codec_ = codec;
+    }
+
+    const fs::path &path() const noexcept { return path_; }
+    bool exists() const;
+    uint32_t version() const noexcept { return version_; }
+    uint64_t size() const noexcept { return size_; }
+
+    // Calls onRecord for every complete record in the log.
+    // A torn record at the end (crash while appending) is ignored and
+    // will be cut off by the next flush.
+    void load(const std::function<void(const LogRecord &)> &onRecord);
+    // Use the log for appending and reading records, without replaying it
+    void attach();
+    void reset() noexcept;
+    // Whether another process appended to, replaced or removed the log,
+    // since it was loaded (or attached, or written) by this one. Then it
+    // has to be loaded again, before appending to it.
+    bool changedOnDisk() const;
+
+    // Returns the offset the record will have in the log
+    uint64_t append(const RecordType type, const uint64_t id,
+            const uint8_t flags, const char *data, const size_t size,
+            const uint16_t part = 0);
+    // Throws, instead of appending, if another process changed the log
+    // since. Only a torn record at the end gets cut off.
+    void flush();
+
+    // Reads a single record, that has already been flushed.
+    // The payload is mapped and only valid until the log changes.
+    // Unless verify is false (only the header gets looked at), it throws,
+    // if the checksum does not match.
+    LogRecord readRecord(const uint64_t offset,
+            const bool verify = true) const;
+    // The mapping payloads of readRecord point into. Holding on to it
+    // keeps them valid, even after the log got remapped or replaced.
+    std::shared_ptr<const MappedFile> region() const noexcept { return map_; }
+    // Calls onRecord for every record, without the payload being touched
+    void scan(const std::function<void(const LogRecord &)> &onRecord) const;
+
+    void addGarbage(const uint64_t bytes) noexcept { garbage_ += bytes; }
+    bool needsCompaction() const noexcept;
+    // Rewrites the log with only the records at keepOffsets, in that order.
+    // Returns the new offsets of those records.
+    std::vector<uint64_t> compact(const std::vector<uint64_t> &keepOffsets);
+};
+
+#endif // __WLCLIPMGR_PAGELOG_HPP
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "pageset.hpp"
+#include "trace.hpp"
+
+std::vector<fs::path>
+findPages(const fs::path &cacheDir)
+{
+    std::vector<std::pair<fs::file_time_type, fs::path>> pages;
+    for (const fs::directory_entry &file : fs::directory_iterator{cacheDir})
+    {
+        const fs::path &path = file.path();
+        if (path.extension() == ".idx")
+            pages.push_back({fs::last_write_time(path),
+                    cacheDir / path.stem()});
+    }
+    std::sort(pages.begin(), pages.end(), [](const auto &a, const auto &b)
+        {
+            return a.first > b.first;
+        });
+
+    std::vector<fs::path> res;
+    for (auto &[writeTime, path] : pages)
+        res.push_back(std::move(path));
+    return res;
+}
+
+PageSet::PageSet(std::vector<fs::path> &&pagePaths,
+        const std::string &gpgUserName, const bool notSecure) :
+    pagePaths_{std::move(pagePaths)}, gpgUserName_{gpgUserName},
+    notSecure_{notSecure}
+{
+}
+
+void
+PageSet::forEach(const std::function<void(LoadedPage &)> &prepare,
+        const std::function<bool(LoadedPage &)> &consume) const
+{
+    const size_t count = pagePaths_.size();
+    std::vector<LoadedPage> pages(count);
+    std::vector<bool> done(count, false);
+    size_t consumed = 0;
+    std::atomic<size_t> next = 0;
+    std::atomic<bool> stop = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    const auto load = [&]()
+    {
+        for (size_t i; !stop && (i = next++) < count;)
+        {
+            {
+                // Don't decrypt the whole history ahead of a slow consumer
+                std::unique_lock lock{mutex};
+                changed.wait(lock, [&]()
+                    {
+                        return stop || i < consumed + PAGE_SET_LOOKAHEAD;
+                    });
+            }
+            LoadedPage &loaded = pages[i];
+            loaded.path_ = pagePaths_[i];
+            if (!stop) try
+            {
+                TraceSpan span{"loadPageSet"};
+                loaded.page_ = std::make_unique<Clipboard>(loaded.path_,
+                        gpgUserName_, notSecure_);
+                loaded.page_->loadPage();
+                prepare(loaded);
+            }
+            catch (const std::exception &err)
+            {
+                loaded.page_.reset();
+                loaded.error_ = err.what();
+            }
+            {
+                std::lock_guard lock{mutex};
+                done[i] = true;
+            }
+            changed.notify_all();
+        }
+    };
+
+    const auto stopLoading = [&]()
+    {
+        {
+            std::lock_guard lock{mutex};
+            stop = true;
+        }
+        changed.notify_all();
+    };
+
+    const size_t threads = std::min<size_t>({count, PAGE_SET_MAX_THREADS,
+            std::max(std::thread::hardware_concurrency(), 1u)});
+    // Joined before anything they use goes away
+    std::vector<std::jthread> workers;
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back(load);
+
+    try
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            {
+                std::unique_lock lock{mutex};
+                changed.wait(lock, [&]() { return done[i]; });
+            }
+            const bool more = consume(pages[i]);
+            pages[i].page_.reset();
+            {
+                std::lock_guard lock{mutex};
+                consumed = i + 1;
+            }
+            changed.notify_all();
+            if (!more)
+                break;
+        }
+    }
+    catch (...)
+    {
+        stopLoading();
+        throw;
+    }
+    stopLoading();
+}
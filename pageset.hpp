@@ -0,0 +1,51 @@
+#ifndef __WLCLIPMGR_PAGESET_HPP
+#define __WLCLIPMGR_PAGESET_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "clipboard.hpp"
+
+#define PAGE_SET_MAX_THREADS 8
+#define PAGE_SET_LOOKAHEAD 16 // pages loaded ahead of the one consumed
+
+// Pages in cacheDir (without extension), most recently written first
+std::vector<fs::path> findPages(const fs::path &cacheDir);
+
+struct LoadedPage
+{
+    fs::path path_;
+    std::unique_ptr<Clipboard> page_;
+    std::vector<size_t> matches_; // for prepare to fill in
+    std::string error_; // why the page could not be loaded
+};
+
+/*
+    Several pages (a week of daily pages, or all of them) for list, search
+    and restore. Each page is its own encrypted file, so they get loaded,
+    decrypted and prepared on a pool of threads, while the results are
+    consumed in the order of the pages. The newest page is printed as
+    soon as it is ready, not after all of them are.
+*/
+class PageSet
+{
+    const std::vector<fs::path> pagePaths_;
+    const std::string gpgUserName_;
+    const bool notSecure_;
+
+    public:
+    PageSet(std::vector<fs::path> &&pagePaths, const std::string &gpgUserName,
+            const bool notSecure);
+
+    // prepare runs on a loading thread after loadPage, consume on the
+    // calling thread in order. Once consume returns false, no more
+    // pages get loaded.
+    void forEach(const std::function<void(LoadedPage &)> &prepare,
+            const std::function<bool(LoadedPage &)> &consume) const;
+};
+
+#endif // __WLCLIPMGR_PAGESET_HPP
@@ -1,101 +1,280 @@
-#include <iostream>
-#include <fstream>
 #include <sstream>
-#include <iomanip>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
 
 #include <ctime>
 #include <cstdlib>
 #include <cstring>
-#include <proc/readproc.h>
-#include <sys/sysinfo.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
 
 #include "procblock.hpp"
+#include "trace.hpp"
 
-bool
-isProcBlocking(const std::string &blockString)
+BlockMatcher::BlockMatcher(const std::string &blockOption)
 {
-    size_t newerThanMax = 0;
-    const auto block = parseBlockOptionEntry(blockString, newerThanMax);
-    std::vector<procInfo_m> kanidates;
-    const auto uptimeSecs = getUpTime();
-    const auto hertz = procps_hertz_get();
-    const auto ownPid = getpid();
-    PROCTAB *proc = openproc(PROC_FILLSTAT | PROC_FILLCOM);
-    while (proc_t *procInfo = readproc(proc, NULL))
+    bool anyAge = false;
+    for (const auto &procStr : stringSplit(blockOption, ','))
     {
-        unsigned long long elapsed = 0;
-        if (newerThanMax > 0)
-        {
-            elapsed = (uptimeSecs - (procInfo->start_time / hertz));
-            if (elapsed > newerThanMax) continue;
-        }
-        if (!procInfo->cmdline || !procInfo->cmdline[0]) continue;
-        if (procInfo->tid == ownPid) continue;
+        const auto proc = stringSplit(procStr, ':');
+        if (proc.empty() || proc.size() > 2 || proc[0].empty())
+            continue;
+        size_t newerThan = 0;
+        if (proc.size() == 2)
+            std::stringstream{proc[1]} >> newerThan; // ignoring errors
+        if (newerThan == 0)
+            anyAge = true;
+        newerThanMax_ = std::max(newerThanMax_, newerThan);
+        patterns_.push_back({proc[0], newerThan});
+    }
+    if (anyAge)
+        newerThanMax_ = 0;
+    build();
+}
 
-        procInfo_m procKanidate{procInfo->cmdline[0], elapsed};
-        for (size_t i = 0; i < 3; i++)
+void
+BlockMatcher::build()
+{
+    // Trie of the patterns, state 0 is the root. (So 0 also means there
+    // is no edge, nothing leads back to the root yet.)
+    next_.assign(1, {});
+    found_.assign(1, {});
+    for (uint32_t i = 0; i < patterns_.size(); i++)
+    {
+        uint32_t state = 0;
+        for (const unsigned char c : patterns_[i].name_)
         {
-            if(procInfo->cmdline[i] == NULL) break;
-            procKanidate.args_.push_back(std::string(procInfo->cmdline[i]));
+            if (next_[state][c] == 0)
+            {
+                next_[state][c] = next_.size();
+                next_.push_back({});
+                found_.push_back({});
+            }
+            state = next_[state][c];
         }
-        kanidates.push_back(procKanidate);
+        found_[state].push_back(i);
+    }
+
+    // Breadth first, missing edges take the edge of the failure state.
+    // After that, matching never has to backtrack.
+    std::vector<uint32_t> fail(next_.size(), 0);
+    std::deque<uint32_t> queue;
+    for (const uint32_t child : next_[0])
+    {
+        if (child != 0)
+            queue.push_back(child);
     }
-    closeproc(proc);
-    for (const procInfo_m &procKanidate : kanidates)
+    while (!queue.empty())
     {
-        for (const procInfo_m &blockingProc : block)
-            if (procKanidate.matches(blockingProc))
-                return true;
+        const uint32_t state = queue.front();
+        queue.pop_front();
+        const std::vector<uint32_t> &inherited = found_[fail[state]];
+        found_[state].insert(found_[state].end(), inherited.begin(),
+                inherited.end());
+
+        for (size_t c = 0; c < next_[state].size(); c++)
+        {
+            const uint32_t child = next_[state][c];
+            if (child == 0)
+            {
+                next_[state][c] = next_[fail[state]][c];
+                continue;
+            }
+            fail[child] = next_[fail[state]][c];
+            queue.push_back(child);
+        }
     }
-    return false;
 }
 
-std::vector<procInfo_m>
-parseBlockOptionEntry(const std::string blockStr,
-        size_t &newerThanMax)
+std::vector<uint32_t>
+BlockMatcher::find(const char *text, const size_t size) const
 {
-    std::vector<procInfo_m> res;
-    for (const auto &procStr : stringSplit(blockStr, ','))
+    std::vector<uint32_t> res;
+    uint32_t state = 0;
+    for (size_t i = 0; i < size; i++)
     {
-        const auto proc = stringSplit(procStr, ':');
-        if (proc.size() == 1)
-            res.push_back(procInfo_m{proc[0], 0});
-        else if (proc.size() == 2)
+        state = next_[state][static_cast<unsigned char>(text[i])];
+        for (const uint32_t pattern : found_[state])
         {
-            size_t newerThan = 0;
-            std::stringstream{proc[1]} >> newerThan;
-            // I do not care if newerThan == 0; ignoring errors;
-            if (newerThanMax < newerThan) newerThanMax = newerThan;
-            res.push_back(procInfo_m{proc[0], newerThan});
+            if (std::find(res.begin(), res.end(), pattern) == res.end())
+                res.push_back(pattern);
         }
     }
     return res;
 }
 
-unsigned long long
-getUpTime(void)
+bool
+BlockMatcher::blocks(const uint32_t pattern, const size_t age) const noexcept
+{
+    const size_t newerThan = patterns_[pattern].newerThan_;
+    return newerThan == 0 || age < newerThan;
+}
+
+// Reads up to size bytes of a (proc) file, returns how many
+static size_t
+readProcFile(const std::string &path, char *buf, const size_t size)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    size_t got = 0;
+    while (got < size)
+    {
+        const ssize_t res = read(fd, buf + got, size - got);
+        if (res <= 0)
+            break;
+        got += res;
+    }
+    close(fd);
+    return got;
+}
+
+// Seconds since the process started
+static size_t
+processAge(const unsigned long long startTime,
+        const unsigned long long uptimeTicks, const long hertz) noexcept
+{
+    return uptimeTicks > startTime ? (uptimeTicks - startTime) / hertz : 0;
+}
+
+// false, if the process is gone already
+static bool
+readStartTime(const std::string &procDir, unsigned long long &startTime)
+{
+    char buf[BLOCK_MATCH_CMDLINE_MAX];
+    // starttime is the 22nd field, the 2nd (comm) may contain anything
+    const size_t statSize = readProcFile(procDir + "/stat", buf,
+            sizeof(buf) - 1);
+    buf[statSize] = '\0';
+    const char *commEnd = std::strrchr(buf, ')');
+    if (commEnd == NULL)
+        return false;
+    std::istringstream fields{commEnd + 1};
+    std::string field;
+    for (int i = 3; i < 22; i++)
+        fields >> field;
+    return static_cast<bool>(fields >> startTime);
+}
+
+bool
+ProcBlocker::readProc(const pid_t pid, const unsigned long long uptimeTicks,
+        const long hertz, Proc &proc) const
 {
-    std::string uptimeSecs;
-    unsigned long long res;
+    const std::string procDir = "/proc/" + std::to_string(pid);
+    if (!readStartTime(procDir, proc.startTime_))
+        return false;
+    proc.settled_ = uptimeTicks >= proc.startTime_ + BLOCK_EXEC_TICKS;
+
+    // Too old to ever block, no need to look at the cmdline
+    char buf[BLOCK_MATCH_CMDLINE_MAX];
+    const size_t age = processAge(proc.startTime_, uptimeTicks, hertz);
+    if (matcher_.newerThanMax() > 0 && age >= matcher_.newerThanMax())
+        return true;
 
-    std::ifstream procUptime{"/proc/uptime", std::ios::in};
-    if (!procUptime || procUptime.fail())
+    // Only the first few args are searched
+    size_t cmdlineSize = readProcFile(procDir + "/cmdline", buf, sizeof(buf));
+    size_t args = 0;
+    for (size_t i = 0; i < cmdlineSize; i++)
     {
-        std::cerr << "Error opening /proc/utime!" << std::endl;
-        throw std::ios::failure("Error opening file!");
+        if (buf[i] == '\0' && ++args == BLOCK_MATCH_ARGS)
+        {
+            cmdlineSize = i;
+            break;
+        }
     }
+    proc.patterns_ = matcher_.find(buf, cmdlineSize);
+    return true;
+}
+
+bool
+ProcBlocker::isBlocking()
+{
+    if (matcher_.empty())
+        return false;
+
+    const auto hertz = procps_hertz_get();
+    const auto uptimeTicks = getUpTimeTicks(hertz);
+    const auto ownPid = getpid();
+    DIR *procDir = opendir("/proc");
+    if (procDir == NULL)
+        throw std::runtime_error("Failed to list /proc!");
+
+    std::unordered_map<pid_t, Proc> seen;
+    seen.reserve(procs_.size());
+    bool blocking = false;
+    while (const dirent *dirEntry = readdir(procDir))
+    {
+        char *end;
+        const pid_t pid = std::strtol(dirEntry->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0 || pid == ownPid)
+            continue;
+
+        // A pid, that is still around and started at the same time, is
+        // still the same process
+        Proc proc;
+        const auto known = procs_.find(pid);
+        unsigned long long startTime;
+        if (known != procs_.end() && known->second.settled_ &&
+                readStartTime("/proc/" + std::to_string(pid), startTime) &&
+                startTime == known->second.startTime_)
+            proc = std::move(known->second);
+        else if (!readProc(pid, uptimeTicks, hertz, proc))
+            continue;
 
-    procUptime >> uptimeSecs;
+        const size_t age = processAge(proc.startTime_, uptimeTicks, hertz);
+        for (const uint32_t pattern : proc.patterns_)
+        {
+            if (matcher_.blocks(pattern, age))
+                blocking = true;
+        }
+        seen.emplace(pid, std::move(proc));
+        if (blocking)
+            break;
+    }
+    closedir(procDir);
 
-    if (procUptime.fail())
+    if (!blocking)
     {
-        std::cerr << "Error reading from /proc/utime. No Permission?"
-            << std::endl;
-        throw std::ios::failure("Error reading from file!");
+        // Everything, that was not seen, has exited
+        procs_ = std::move(seen);
+        return false;
     }
+    for (auto &[pid, proc] : seen)
+        procs_.insert_or_assign(pid, std::move(proc));
+    return true;
+}
 
-    std::stringstream{uptimeSecs} >> res;
-    return res;
+bool
+isProcBlocking(const std::string &blockOption)
+{
+    TraceSpan span{"isProcBlocking"};
+    static std::unordered_map<std::string,
+        std::unique_ptr<ProcBlocker>> blockers;
+    std::unique_ptr<ProcBlocker> &blocker = blockers[blockOption];
+    if (!blocker)
+        blocker = std::make_unique<ProcBlocker>(blockOption);
+    return blocker->isBlocking();
+}
+
+unsigned long long
+getUpTime(void)
+{
+    // What /proc/uptime says, without opening it
+    timespec now;
+    if (clock_gettime(CLOCK_BOOTTIME, &now) != 0)
+        throw std::runtime_error("Failed to get the uptime!");
+    return now.tv_sec;
+}
+
+unsigned long long
+getUpTimeTicks(const long hertz)
+{
+    timespec now;
+    if (clock_gettime(CLOCK_BOOTTIME, &now) != 0)
+        throw std::runtime_error("Failed to get the uptime!");
+    return now.tv_sec * hertz + now.tv_nsec / (1000000000 / hertz);
 }
 
 //  ..include/proc/misc.h seems to not be present in archlinux
@@ -1,40 +1,92 @@
 #ifndef __WLCLIPMGR_PROCBLOCK_HPP
 #define __WLCLIPMGR_PROCBLOCK_HPP
 
+#include <array>
+#include <memory>
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <sys/types.h>
 
-struct procInfo_m
-{
-    const std::string name_;
-    const size_t age_;
-    std::vector<std::string> args_;
+#define BLOCK_MATCH_ARGS 3 // of the cmdline, that are searched
+#define BLOCK_MATCH_CMDLINE_MAX 0x1000
+// Clock ticks a process gets to exec, before its cmdline is remembered
+#define BLOCK_EXEC_TICKS 10
 
-    procInfo_m(const std::string name, const size_t age)
-        : name_{name}, age_{age}
+/*
+    The patterns of a block option (e.g. pass:10,scary_app), compiled into
+    an Aho-Corasick automaton. So a cmdline is searched for all of them
+    in a single pass.
+*/
+class BlockMatcher
+{
+    struct Pattern
     {
-        args_.push_back(name);
-    }
-    bool matches(const procInfo_m &other) const
+        std::string name_;
+        size_t newerThan_; // seconds, 0 -> blocks regardless of age
+    };
+    std::vector<Pattern> patterns_;
+    // state -> next state, for every byte
+    std::vector<std::array<uint32_t, 256>> next_;
+    // state -> patterns ending there
+    std::vector<std::vector<uint32_t>> found_;
+    size_t newerThanMax_ = 0;
+
+    void build();
+
+    public:
+    explicit BlockMatcher(const std::string &blockOption);
+
+    bool empty() const noexcept { return patterns_.empty(); }
+    // Processes older than this can not block, 0 if they all can
+    size_t newerThanMax() const noexcept { return newerThanMax_; }
+
+    // Indexes of the patterns occurring in text
+    std::vector<uint32_t> find(const char *text, const size_t size) const;
+    // Whether pattern blocks a process, that is age seconds old
+    bool blocks(const uint32_t pattern, const size_t age) const noexcept;
+};
+
+/*
+    Remembers which processes matched which patterns, by pid. Only the
+    cmdline of processes, that were started since the last check, has to
+    be read. The rest costs listing /proc and reading their stat, to
+    notice a pid that got reused. Forked processes, that might not have
+    exec'd yet, are read again until they are BLOCK_EXEC_TICKS old.
+    (The proc connector would tell us about new processes, but it needs
+    CAP_NET_ADMIN.)
+*/
+class ProcBlocker
+{
+    struct Proc
     {
-        for (const auto &arg : args_)
-        {
-            if ((arg.find(other.name_) != std::string::npos) &&
-                    age_ < other.age_)
-                return true;
-        }
-        return false;
-    }
+        unsigned long long startTime_; // clock ticks since boot
+        std::vector<uint32_t> patterns_;
+        bool settled_ = false; // old enough, to have exec'd
+    };
+    const BlockMatcher matcher_;
+    std::unordered_map<pid_t, Proc> procs_;
+
+    bool readProc(const pid_t pid, const unsigned long long uptimeTicks,
+            const long hertz, Proc &proc) const;
+
+    public:
+    explicit ProcBlocker(const std::string &blockOption) :
+        matcher_{blockOption} {}
+
+    // Stops at the first blocking process
+    bool isBlocking();
 };
 
+// Blockers are kept per block option for the whole process, so a daemon
+// profits from the cache.
 bool isProcBlocking(const std::string &blockOption);
 
-std::vector<procInfo_m> parseBlockOptionEntry(const std::string blockOption,
-        size_t &newerThanMax); // parse the block argument string
-unsigned long long getUpTime(void); // get /proc/uptime
+unsigned long long getUpTime(void); // seconds since boot
+unsigned long long getUpTimeTicks(const long hertz); // clock ticks since boot
 long procps_hertz_get(void); // get system hertz (ripped from procps)
 std::vector<std::string> stringSplit(const std::string &s, const char delim);
 
 
 #endif //__WLCLIPMGR_PROCBLOCK_HPP
-
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <chrono>
+#include <ctime>
+
+#include "retention.hpp"
+#include "clipboard.hpp"
+#include "pageset.hpp"
+#include "trace.hpp"
+#include "pagelock.hpp"
+
+static bool
+writtenBefore(const fs::path &pagePath, const uint64_t cutoff)
+{
+    std::error_code ec;
+    const auto writeTime = fs::last_write_time(pagePath.string() + ".idx", ec);
+    if (ec)
+        return false;
+    const auto sysTime = std::chrono::file_clock::to_sys(writeTime);
+    return static_cast<uint64_t>(std::chrono::duration_cast<
+            std::chrono::seconds>(sysTime.time_since_epoch()).count()) < cutoff;
+}
+
+bool
+pruneHistory(const fs::path &cacheDir, const std::string &currentPage,
+        const RetentionPolicy &policy, const std::string &gpgUserName,
+        const bool notSecure)
+{
+    if (policy.maxAgeDays_ == 0)
+        return false;
+    const uint64_t cutoff = std::time(0) -
+        policy.maxAgeDays_ * SECONDS_PER_DAY;
+
+    std::vector<fs::path> pagePaths = findPages(cacheDir);
+    std::vector<fs::path> expired;
+    std::vector<fs::path> kept;
+    for (fs::path &pagePath : pagePaths)
+    {
+        if (pagePath.filename() != currentPage &&
+                writtenBefore(pagePath, cutoff))
+            expired.push_back(std::move(pagePath));
+        else
+            kept.push_back(std::move(pagePath));
+    }
+    if (expired.empty())
+        return false;
+    TraceSpan span{"pruneHistory"};
+
+    // Loaded once, the data of references has to be read from them first
+    std::vector<std::unique_ptr<Clipboard>> expiredPages;
+    for (const fs::path &pagePath : expired)
+    {
+        auto page = std::make_unique<Clipboard>(pagePath, gpgUserName,
+                notSecure);
+        try
+        {
+            page->loadPage();
+        }
+        catch (const std::runtime_error &err)
+        {
+            std::cerr << "Not pruning page " << pagePath.filename().string()
+                << ": " << err.what() << std::endl;
+            continue;
+        }
+        expiredPages.push_back(std::move(page));
+    }
+
+    // Pages with pinned entries stay, so their references have to be
+    // copied as well
+    const auto materialize = [&](Clipboard &page, const bool loaded)
+    {
+        const PageLock lock{page.pagePath()};
+        if (!loaded)
+            page.loadPage();
+        else if (page.changedOnDisk())
+            page.reloadPage();
+        for (const std::unique_ptr<Clipboard> &expiredPage : expiredPages)
+        {
+            if (expiredPage->pageName() != page.pageName())
+                page.materializeRefs(expiredPage->pageName());
+        }
+    };
+    try
+    {
+        for (const fs::path &pagePath : kept)
+        {
+            Clipboard page{pagePath, gpgUserName, notSecure};
+            materialize(page, false);
+        }
+        for (const std::unique_ptr<Clipboard> &page : expiredPages)
+        {
+            if (page->hasPinned())
+                materialize(*page, true);
+        }
+    }
+    catch (const std::runtime_error &err)
+    {
+        // Their references would break, keep everything for now
+        std::cerr << "Not pruning, failed to copy referenced entries: "
+            << err.what() << std::endl;
+        return false;
+    }
+
+    for (const std::unique_ptr<Clipboard> &page : expiredPages)
+    {
+        const PageLock lock{page->pagePath()};
+        // Written again meanwhile, it is not that old after all
+        if (page->changedOnDisk())
+            continue;
+        if (!page->hasPinned())
+        {
+            page->removePage();
+            continue;
+        }
+        // Everything but the pinned entries is too old
+        RetentionPolicy pinnedOnly;
+        pinnedOnly.maxEntries_ = 1;
+        if (page->evict(pinnedOnly, false) == 0)
+            continue;
+        page->writePage();
+        page->compactPage();
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef __WLCLIPMGR_RETENTION_HPP
+#define __WLCLIPMGR_RETENTION_HPP
+
+#include <string>
+#include <cstdint>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#define SECONDS_PER_DAY (24 * 60 * 60)
+
+/*
+    How much history to keep, 0 means no limit.
+    maxEntries_ and maxBytes_ hold per page and are enforced on every
+    copy, by appending remove records for the oldest entries (the page
+    gets compacted later, once enough of it is garbage). maxAgeDays_
+    also drops whole pages, that were not written for that long.
+    Pinned entries are never evicted, neither is the current selection.
+*/
+struct RetentionPolicy
+{
+    size_t maxEntries_ = 0;
+    uint64_t maxBytes_ = 0; // of stored data, references do not count
+    uint64_t maxAgeDays_ = 0;
+
+    bool limitsEntries() const noexcept
+    {
+        return maxEntries_ != 0 || maxBytes_ != 0 || maxAgeDays_ != 0;
+    }
+};
+
+// Drops pages (other than currentPage) not written for maxAgeDays_.
+// Pages with pinned entries only lose their other entries. Entries of
+// newer pages, that only reference data in them, get a copy of it first.
+// Returns whether anything got pruned.
+bool pruneHistory(const fs::path &cacheDir, const std::string &currentPage,
+        const RetentionPolicy &policy, const std::string &gpgUserName,
+        const bool notSecure);
+
+#endif // __WLCLIPMGR_RETENTION_HPP
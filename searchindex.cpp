@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cctype>
+#include <cstring>
+
+#include "searchindex.hpp"
+
+static unsigned char
+lowerAscii(const unsigned char c) noexcept
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+std::vector<Trigram>
+extractTrigrams(const std::span<const char> text, bool &truncated)
+{
+    truncated = text.size() > SEARCH_INDEX_MAX_BYTES;
+    const size_t size = std::min(text.size(), (size_t)SEARCH_INDEX_MAX_BYTES);
+    std::vector<Trigram> res;
+    if (size < 3)
+        return res;
+
+    res.reserve(size - 2);
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(
+            text.data());
+    Trigram trigram = (lowerAscii(bytes[0]) << 8) | lowerAscii(bytes[1]);
+    for (size_t i = 2; i < size; i++)
+    {
+        trigram = ((trigram << 8) | lowerAscii(bytes[i])) & 0xffffff;
+        res.push_back(trigram);
+    }
+    std::sort(res.begin(), res.end());
+    res.erase(std::unique(res.begin(), res.end()), res.end());
+    return res;
+}
+
+/*
+    The longest run of characters, every match of regex has to contain.
+    Only simple regexes get one, anything with alternatives has none.
+*/
+static std::string
+requiredLiteral(const std::string &regex)
+{
+    if (regex.find('|') != std::string::npos)
+        return {};
+
+    std::string longest;
+    std::string current;
+    // Groups might be optional as a whole, only look outside of them
+    int depth = 0;
+    const auto endRun = [&]()
+    {
+        if (current.size() > longest.size())
+            longest = current;
+        current.clear();
+    };
+    for (size_t i = 0; i < regex.size(); i++)
+    {
+        char c = regex[i];
+        if (c == '\\')
+        {
+            // Escaped punctuation is literal, \d, \w, ... are not
+            if (i + 1 >= regex.size() || std::isalnum(
+                        static_cast<unsigned char>(regex[i + 1])))
+            {
+                endRun();
+                i++;
+                continue;
+            }
+            c = regex[++i];
+        }
+        else if (c == '[')
+        {
+            endRun();
+            const size_t close = regex.find(']', i + 2);
+            if (close == std::string::npos)
+                return {};
+            i = close;
+            continue;
+        }
+        else if (c == '(' || c == ')')
+        {
+            depth += c == '(' ? 1 : -1;
+            endRun();
+            continue;
+        }
+        else if (std::strchr("^$.", c))
+        {
+            endRun();
+            continue;
+        }
+        else if (std::strchr("?*+{", c))
+        {
+            // The last char might not be there at all ('+' keeps it,
+            // but not what follows)
+            if (c != '+' && !current.empty())
+                current.pop_back();
+            endRun();
+            if (c == '{')
+            {
+                i = regex.find('}', i);
+                if (i == std::string::npos)
+                    return {};
+            }
+            continue;
+        }
+
+        // Inside a group, or optional, if a quantifier follows
+        if (depth > 0 || (i + 1 < regex.size() &&
+                    std::strchr("?*{", regex[i + 1])))
+        {
+            endRun();
+            continue;
+        }
+        current.push_back(c);
+    }
+    endRun();
+    return longest;
+}
+
+SearchQuery::SearchQuery(const std::string &pattern, const bool isRegex,
+        const bool ignoreCase) :
+    pattern_{pattern}, ignoreCase_{ignoreCase}, isRegex_{isRegex}
+{
+    if (isRegex_)
+    {
+        auto flags = std::regex::ECMAScript | std::regex::optimize;
+        if (ignoreCase_)
+            flags |= std::regex::icase;
+        try
+        {
+            regex_ = std::regex{pattern_, flags};
+        }
+        catch (const std::regex_error &err)
+        {
+            throw std::runtime_error("Invalid regex: " +
+                    std::string{err.what()});
+        }
+    }
+
+    const std::string literal = isRegex_ ? requiredLiteral(pattern_) :
+        pattern_;
+    bool truncated;
+    trigrams_ = extractTrigrams(literal, truncated);
+}
+
+bool
+SearchQuery::mightMatch(const std::vector<Trigram> &trigrams,
+        const bool truncated) const noexcept
+{
+    if (truncated)
+        return true;
+    return std::includes(trigrams.begin(), trigrams.end(), trigrams_.begin(),
+            trigrams_.end());
+}
+
+bool
+SearchQuery::matches(const std::span<const char> text) const
+{
+    if (isRegex_)
+        return std::regex_search(text.begin(), text.end(), regex_);
+
+    if (!ignoreCase_)
+        return std::search(text.begin(), text.end(), pattern_.begin(),
+                pattern_.end()) != text.end();
+    return std::search(text.begin(), text.end(), pattern_.begin(),
+            pattern_.end(), [](const char a, const char b)
+            {
+                return lowerAscii(a) == lowerAscii(b);
+            }) != text.end();
+}
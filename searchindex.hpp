@@ -0,0 +1,44 @@
+#ifndef __WLCLIPMGR_SEARCHINDEX_HPP
+#define __WLCLIPMGR_SEARCHINDEX_HPP
+
+#include <span>
+#include <regex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define SEARCH_INDEX_MAX_BYTES 0x10000 // of an entry, that get indexed
+
+/*
+    Trigram index for searching text entries. Every text entry of a page
+    gets the sorted set of trigrams (three consecutive bytes, ASCII
+    lowercased) of its text stored in <page>.tri, sealed like the page.
+    A query only has to look at the data of entries, that contain all
+    trigrams of the query (or of the longest literal in a regex).
+*/
+using Trigram = uint32_t;
+
+// Sorted and unique. truncated is set, if only the start got indexed.
+std::vector<Trigram> extractTrigrams(const std::span<const char> text,
+        bool &truncated);
+
+class SearchQuery
+{
+    std::string pattern_;
+    bool ignoreCase_;
+    bool isRegex_;
+    std::regex regex_;
+    std::vector<Trigram> trigrams_;
+
+    public:
+    SearchQuery(const std::string &pattern, const bool isRegex,
+            const bool ignoreCase);
+
+    // Whether an entry with these trigrams might match. Entries with
+    // a truncated index always might.
+    bool mightMatch(const std::vector<Trigram> &trigrams,
+            const bool truncated) const noexcept;
+    bool matches(const std::span<const char> text) const;
+};
+
+#endif // __WLCLIPMGR_SEARCHINDEX_HPP
@@ -0,0 +1,126 @@
+#include <string>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+
+#include <gcrypt.h>
+
+#include "sessionkey.hpp"
+
+void
+initGcrypt()
+{
+    static const bool initialized = []()
+    {
+        if (!gcry_check_version(GCRYPT_VERSION))
+            throw std::runtime_error("libgcrypt version mismatch!");
+        gcry_control(GCRYCTL_INITIALIZATION_FINISHED, 0);
+        return true;
+    }();
+    (void)initialized;
+}
+
+static void
+throwIfError(const gcry_error_t err, const std::string &msg)
+{
+    if (err)
+        throw std::runtime_error(msg + " (" + gcry_strerror(err) + ")");
+}
+
+using CipherHandle = std::unique_ptr<gcry_cipher_hd_t,
+      void (*)(gcry_cipher_hd_t *)>;
+
+static CipherHandle
+openCipher(const SessionKey &key, const char *nonce, const uint64_t associated)
+{
+    CipherHandle hd{new gcry_cipher_hd_t{}, [](gcry_cipher_hd_t *hd)
+        {
+            gcry_cipher_close(*hd);
+            delete hd;
+        }};
+    throwIfError(gcry_cipher_open(hd.get(), GCRY_CIPHER_AES256,
+                GCRY_CIPHER_MODE_GCM, 0), "Failed to set up AES-GCM!");
+    throwIfError(gcry_cipher_setkey(*hd, key.data(), key.size()),
+            "Failed to set the session key!");
+    throwIfError(gcry_cipher_setiv(*hd, nonce, SESSION_NONCE_SIZE),
+            "Failed to set the nonce!");
+    throwIfError(gcry_cipher_authenticate(*hd, &associated,
+                sizeof(associated)), "Failed to set associated data!");
+    return hd;
+}
+
+SessionKey::~SessionKey()
+{
+    explicit_bzero(key_.data(), key_.size());
+}
+
+std::unique_ptr<SessionKey>
+SessionKey::generate()
+{
+    initGcrypt();
+    std::unique_ptr<SessionKey> key{new SessionKey};
+    gcry_randomize(key->key_.data(), key->key_.size(), GCRY_STRONG_RANDOM);
+    return key;
+}
+
+std::unique_ptr<SessionKey>
+SessionKey::fromBytes(const char *data, const size_t size)
+{
+    if (size != SESSION_KEY_SIZE)
+        throw std::runtime_error("Session key of the page is damaged!");
+    initGcrypt();
+    std::unique_ptr<SessionKey> key{new SessionKey};
+    std::memcpy(key->key_.data(), data, size);
+    return key;
+}
+
+std::vector<char>
+SessionKey::seal(const char *data, const size_t size,
+        const uint64_t associated) const
+{
+    std::vector<char> res(SESSION_NONCE_SIZE + size + SESSION_TAG_SIZE);
+    gcry_create_nonce(res.data(), SESSION_NONCE_SIZE);
+
+    const CipherHandle hd = openCipher(*this, res.data(), associated);
+    char *cipherText = res.data() + SESSION_NONCE_SIZE;
+    throwIfError(gcry_cipher_final(*hd), "Failed to finalize AES-GCM!");
+    throwIfError(gcry_cipher_encrypt(*hd, cipherText, size, data, size),
+            "Encrypting entry failed!");
+    throwIfError(gcry_cipher_gettag(*hd, cipherText + size, SESSION_TAG_SIZE),
+            "Failed to get the authentication tag!");
+    return res;
+}
+
+std::vector<char>
+SessionKey::open(const char *data, const size_t size,
+        const uint64_t associated) const
+{
+    std::vector<char> res(openedSize(size));
+    open(data, size, associated, res);
+    return res;
+}
+
+size_t
+SessionKey::openedSize(const size_t size)
+{
+    if (size < SESSION_NONCE_SIZE + SESSION_TAG_SIZE)
+        throw std::runtime_error("Encrypted entry is truncated!");
+    return size - SESSION_NONCE_SIZE - SESSION_TAG_SIZE;
+}
+
+void
+SessionKey::open(const char *data, const size_t size,
+        const uint64_t associated, const std::span<char> out) const
+{
+    const size_t plainSize = openedSize(size);
+    if (out.size() != plainSize)
+        throw std::runtime_error("Buffer does not fit the encrypted entry!");
+    const char *cipherText = data + SESSION_NONCE_SIZE;
+
+    const CipherHandle hd = openCipher(*this, data, associated);
+    throwIfError(gcry_cipher_final(*hd), "Failed to finalize AES-GCM!");
+    throwIfError(gcry_cipher_decrypt(*hd, out.data(), plainSize, cipherText,
+                plainSize), "Decrypting entry failed!");
+    throwIfError(gcry_cipher_checktag(*hd, cipherText + plainSize,
+                SESSION_TAG_SIZE), "Entry failed authentication!");
+}
@@ -0,0 +1,56 @@
+#ifndef __WLCLIPMGR_SESSIONKEY_HPP
+#define __WLCLIPMGR_SESSIONKEY_HPP
+
+#include <span>
+#include <array>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#define SESSION_KEY_SIZE 32 // AES-256
+#define SESSION_NONCE_SIZE 12
+#define SESSION_TAG_SIZE 16
+
+/*
+    Symmetric per-page key. Entries are sealed with it individually,
+    the key itself is stored in the page wrapped with the users gpg key.
+    So storing or listing only needs a single (small) gpg decryption.
+*/
+class SessionKey
+{
+    std::array<unsigned char, SESSION_KEY_SIZE> key_;
+
+    SessionKey() = default;
+
+    public:
+    ~SessionKey();
+    SessionKey(const SessionKey &) = delete;
+    SessionKey &operator=(const SessionKey &) = delete;
+
+    static std::unique_ptr<SessionKey> generate();
+    static std::unique_ptr<SessionKey> fromBytes(const char *data,
+            const size_t size);
+
+    const char *data() const noexcept
+    {
+        return reinterpret_cast<const char *>(key_.data());
+    }
+    size_t size() const noexcept { return key_.size(); }
+
+    // Result: nonce | ciphertext | tag
+    // associated binds the sealed data to the place it is stored at,
+    // so records can not be swapped around.
+    std::vector<char> seal(const char *data, const size_t size,
+            const uint64_t associated) const;
+    std::vector<char> open(const char *data, const size_t size,
+            const uint64_t associated) const;
+    static size_t openedSize(const size_t size);
+    // Into out, which has to be openedSize(size) big
+    void open(const char *data, const size_t size, const uint64_t associated,
+            const std::span<char> out) const;
+};
+
+// libgcrypt has to be initialized once, before it is used
+void initGcrypt();
+
+#endif // __WLCLIPMGR_SESSIONKEY_HPP
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "spool.hpp"
+#include "ingest.hpp"
+#include "trace.hpp"
+
+StoreSpool::StoreSpool(const std::string &page)
+{
+    const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir == NULL || *runtimeDir == '\0')
+        return;
+    dir_ = fs::path{runtimeDir} / "wlclipmgr" / (page + ".spool");
+}
+
+bool
+StoreSpool::empty() const
+{
+    std::error_code ec;
+    return !available() || fs::is_empty(dir_, ec) || ec;
+}
+
+bool
+StoreSpool::queue(const Ingest &selection)
+{
+    if (!available())
+        return false;
+    if (selection.tooBig())
+    {
+        std::cout << "ClipboardEntry is bigger than "
+            << Clipboard::maxEntrySize()
+            << " bytes, not saving that!" << std::endl;
+        return true;
+    }
+    TraceSpan span{"queueStore"};
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    fs::permissions(dir_.parent_path(), fs::perms::owner_all, ec);
+    fs::permissions(dir_, fs::perms::owner_all, ec);
+    if (ec)
+        return false;
+
+    // Sorting the names sorts the copies by when they came in
+    char name[48];
+    std::snprintf(name, sizeof(name), "%020lld-%d",
+            static_cast<long long>(std::chrono::duration_cast<
+                std::chrono::nanoseconds>(std::chrono::system_clock::now()
+                    .time_since_epoch()).count()), getpid());
+    const fs::path path = dir_ / name;
+    const fs::path tmpPath{path.string() + ".tmp"};
+    const int outFd = open(tmpPath.c_str(),
+            O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (outFd < 0)
+        return false;
+
+    const std::span<const char> data = selection.data();
+    bool ok = true;
+    for (size_t written = 0; ok && written < data.size();)
+    {
+        const ssize_t res = write(outFd, data.data() + written,
+                data.size() - written);
+        if (res < 0 && errno == EINTR)
+            continue;
+        ok = res > 0;
+        written += res;
+    }
+    close(outFd);
+    if (ok)
+        fs::rename(tmpPath, path, ec);
+    if (!ok || ec)
+    {
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+size_t
+StoreSpool::drain(Clipboard &clipboard)
+{
+    if (empty())
+        return 0;
+    TraceSpan span{"drainStores"};
+    std::vector<fs::path> queued;
+    for (const fs::directory_entry &file : fs::directory_iterator{dir_})
+    {
+        // Still being written
+        if (file.path().extension() != ".tmp")
+            queued.push_back(file.path());
+    }
+    std::sort(queued.begin(), queued.end());
+
+    size_t added = 0;
+    for (const fs::path &path : queued)
+    {
+        Ingest selection{Clipboard::maxEntrySize()};
+        const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        bool complete = true;
+        try
+        {
+            selection.expectFrom(fd);
+            selection.readAll(fd);
+        }
+        catch (const std::runtime_error &err)
+        {
+            std::cerr << "Dropping queued copy " << path.filename().string()
+                << ": " << err.what() << std::endl;
+            complete = false;
+        }
+        close(fd);
+        std::error_code ec;
+        fs::remove(path, ec);
+        if (complete && clipboard.addEntry(std::move(selection), ""))
+            added++;
+    }
+    return added;
+}
@@ -0,0 +1,39 @@
+#ifndef __WLCLIPMGR_SPOOL_HPP
+#define __WLCLIPMGR_SPOOL_HPP
+
+#include <string>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "clipboard.hpp"
+#include "ingest.hpp"
+
+/*
+    Copies, that come in while another process holds the lock of the
+    page, are queued as files in $XDG_RUNTIME_DIR/wlclipmgr. Whoever
+    holds the lock adds them before writing the page, so a burst of
+    stores ends up in one write, instead of each waiting for the one
+    before.
+
+    The queued copies are plaintext, so this is only used for pages
+    stored with --no-encryption. Stores to encrypted pages wait for the
+    lock instead.
+*/
+class StoreSpool
+{
+    fs::path dir_; // empty, if there is no runtime dir
+
+    public:
+    explicit StoreSpool(const std::string &page);
+
+    bool available() const noexcept { return !dir_.empty(); }
+    bool empty() const;
+    // Queues the copy. Returns false, if it could not, then the copy
+    // has to be stored directly.
+    bool queue(const Ingest &selection);
+    // Adds the queued copies to clipboard, oldest first.
+    // Returns how many were new.
+    size_t drain(Clipboard &clipboard);
+};
+
+#endif // __WLCLIPMGR_SPOOL_HPP
@@ -0,0 +1,275 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+
+#include <unistd.h>
+
+#include "trace.hpp"
+
+struct StatsHeader
+{
+    char magic_[8];
+    uint32_t version_;
+    uint32_t stages_;
+};
+static_assert(sizeof(StatsHeader) == 16);
+
+struct StatsStage
+{
+    char name_[STATS_STAGE_NAME_SIZE];
+    std::array<uint32_t, STATS_BUCKETS> counts_;
+};
+
+static size_t
+bucketOf(const uint64_t us) noexcept
+{
+    if (us == 0)
+        return 0;
+    const size_t bucket = static_cast<size_t>(
+            std::log2(static_cast<double>(us)) * STATS_BUCKETS_PER_DOUBLING) + 1;
+    return std::min<size_t>(bucket, STATS_BUCKETS - 1);
+}
+
+static uint64_t
+bucketLimit(const size_t bucket) noexcept
+{
+    return static_cast<uint64_t>(std::ceil(std::exp2(
+                    static_cast<double>(bucket) / STATS_BUCKETS_PER_DOUBLING)));
+}
+
+void
+StageHistogram::add(const uint64_t us) noexcept
+{
+    counts_[bucketOf(us)]++;
+}
+
+void
+StageHistogram::merge(const StageHistogram &other) noexcept
+{
+    for (size_t i = 0; i < STATS_BUCKETS; i++)
+        counts_[i] += other.counts_[i];
+
+    if (count() > STATS_WINDOW)
+    {
+        for (uint32_t &count : counts_)
+            count = (count + 1) / 2;
+    }
+}
+
+uint64_t
+StageHistogram::count() const noexcept
+{
+    uint64_t res = 0;
+    for (const uint32_t count : counts_)
+        res += count;
+    return res;
+}
+
+uint64_t
+StageHistogram::percentile(const double p) const noexcept
+{
+    const uint64_t total = count();
+    if (total == 0)
+        return 0;
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(total * p));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < STATS_BUCKETS; i++)
+    {
+        seen += counts_[i];
+        if (seen >= rank)
+            return bucketLimit(i);
+    }
+    return bucketLimit(STATS_BUCKETS - 1);
+}
+
+Tracer &
+Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+uint64_t
+Tracer::nowUs() noexcept
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+void
+Tracer::traceTo(const fs::path &path)
+{
+    tracePath_ = path;
+    enabled_ = true;
+}
+
+void
+Tracer::collectStats(const fs::path &path)
+{
+    statsPath_ = path;
+    enabled_ = true;
+}
+
+void
+Tracer::record(const char *stage, const uint64_t startUs,
+        const uint64_t endUs)
+{
+    const uint64_t durationUs = endUs - startUs;
+    std::lock_guard lock{mutex_};
+    if (!statsPath_.empty())
+        stages_[stage].add(durationUs);
+    if (!tracePath_.empty() && events_.size() < TRACE_MAX_EVENTS)
+        events_.push_back({stage, startUs, durationUs, gettid()});
+}
+
+void
+Tracer::writeTrace() const
+{
+    std::ofstream traceFile{tracePath_};
+    const pid_t pid = getpid();
+    traceFile << "{\"traceEvents\": [";
+    for (size_t i = 0; i < events_.size(); i++)
+    {
+        const Event &event = events_[i];
+        traceFile << (i == 0 ? "\n" : ",\n")
+            << "{\"name\": \"" << event.stage_ << "\", \"ph\": \"X\""
+            << ", \"ts\": " << event.startUs_
+            << ", \"dur\": " << event.durationUs_
+            << ", \"pid\": " << pid << ", \"tid\": " << event.threadId_
+            << "}";
+    }
+    traceFile << "\n], \"displayTimeUnit\": \"ms\"}" << std::endl;
+    if (!traceFile)
+        std::cerr << "Failed to write the trace to " << tracePath_.string()
+            << std::endl;
+}
+
+std::map<std::string, StageHistogram>
+loadStats(const fs::path &path)
+{
+    std::map<std::string, StageHistogram> res;
+    std::ifstream statsFile{path, std::ios::in | std::ios::binary};
+    if (!statsFile)
+        return res;
+
+    StatsHeader header;
+    if (!statsFile.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            std::memcmp(header.magic_, STATS_MAGIC, sizeof(header.magic_)) != 0 ||
+            header.version_ != STATS_VERSION)
+    {
+        std::cerr << "Ignoring damaged stats in " << path.string() << std::endl;
+        return res;
+    }
+
+    StatsStage stage;
+    for (uint32_t i = 0; i < header.stages_ &&
+            statsFile.read(reinterpret_cast<char *>(&stage), sizeof(stage)); i++)
+    {
+        stage.name_[STATS_STAGE_NAME_SIZE - 1] = '\0';
+        res[stage.name_].counts_ = stage.counts_;
+    }
+    return res;
+}
+
+// Several invocations can run at the same time, the last one to rename
+// its file wins. Losing a few samples is fine for stats.
+void
+Tracer::writeStats()
+{
+    std::map<std::string, StageHistogram> stats = loadStats(statsPath_);
+    for (const auto &[name, histogram] : stages_)
+        stats[name].merge(histogram);
+    stages_.clear();
+
+    StatsHeader header{};
+    std::memcpy(header.magic_, STATS_MAGIC, sizeof(header.magic_));
+    header.version_ = STATS_VERSION;
+    header.stages_ = stats.size();
+
+    const fs::path tmpPath{statsPath_.string() + "." +
+        std::to_string(getpid())};
+    std::ofstream statsFile{tmpPath, std::ios::out | std::ios::binary};
+    statsFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const auto &[name, histogram] : stats)
+    {
+        StatsStage stage{};
+        name.copy(stage.name_, STATS_STAGE_NAME_SIZE - 1);
+        stage.counts_ = histogram.counts_;
+        statsFile.write(reinterpret_cast<const char *>(&stage), sizeof(stage));
+    }
+    statsFile.close();
+    std::error_code ec;
+    if (statsFile)
+        fs::rename(tmpPath, statsPath_, ec);
+    if (!statsFile || ec)
+    {
+        std::cerr << "Failed to write " << statsPath_.string() << std::endl;
+        fs::remove(tmpPath, ec);
+    }
+}
+
+void
+Tracer::flush()
+{
+    std::lock_guard lock{mutex_};
+    if (!tracePath_.empty())
+        writeTrace();
+    if (!statsPath_.empty() && !stages_.empty())
+        writeStats();
+}
+
+void
+Tracer::stop()
+{
+    std::lock_guard lock{mutex_};
+    enabled_ = false;
+    tracePath_.clear();
+    statsPath_.clear();
+    events_.clear();
+    stages_.clear();
+}
+
+static std::string
+formatUs(const uint64_t us)
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(us < 10000 ? 2 : 0);
+    if (us < 1000)
+        ss << us << "us";
+    else if (us < 10000000)
+        ss << us / 1000.0 << "ms";
+    else
+        ss << us / 1000000.0 << "s";
+    return ss.str();
+}
+
+void
+printStats(const fs::path &path)
+{
+    const std::map<std::string, StageHistogram> stats = loadStats(path);
+    if (stats.empty())
+    {
+        std::cout << "No stats collected yet, see --collect-stats." << std::endl;
+        return;
+    }
+
+    std::cout << std::left << std::setw(24) << "stage" << std::right
+        << std::setw(8) << "count" << std::setw(10) << "p50"
+        << std::setw(10) << "p90" << std::setw(10) << "p99"
+        << std::setw(10) << "max" << std::endl;
+    for (const auto &[name, histogram] : stats)
+    {
+        std::cout << std::left << std::setw(24) << name << std::right
+            << std::setw(8) << histogram.count()
+            << std::setw(10) << formatUs(histogram.percentile(0.5))
+            << std::setw(10) << formatUs(histogram.percentile(0.9))
+            << std::setw(10) << formatUs(histogram.percentile(0.99))
+            << std::setw(10) << formatUs(histogram.percentile(1.0))
+            << std::endl;
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef __WLCLIPMGR_TRACE_HPP
+#define __WLCLIPMGR_TRACE_HPP
+
+#include <map>
+#include <mutex>
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#define TRACE_STATS_FILE "stats"
+#define TRACE_MAX_EVENTS 0x10000
+#define STATS_MAGIC "WLCPSTAT"
+#define STATS_VERSION 1
+#define STATS_STAGE_NAME_SIZE 32
+#define STATS_BUCKETS_PER_DOUBLING 4
+#define STATS_BUCKETS 160 // 1 us up to 2^40 us
+#define STATS_WINDOW 0x1000 // halve a stage, once it has more samples
+
+/*
+    Timing of the stages of a command (gpg, loading the page, mime
+    sniffing, ...). A TraceSpan measures the scope it lives in.
+
+    With --trace the spans are written as Chrome trace JSON (load it in
+    chrome://tracing or ui.perfetto.dev). With --collect-stats they go
+    into per-stage histograms in <cache>/stats, which `wlclipmgr stats`
+    prints percentiles of. Best given to the daemon, which merges them
+    into the file once per burst of selections. The histograms get halved
+    once a stage collected STATS_WINDOW samples, so they follow recent
+    behaviour.
+
+    When neither is enabled, a span is a single branch.
+*/
+
+struct StageHistogram
+{
+    std::array<uint32_t, STATS_BUCKETS> counts_{};
+
+    void add(const uint64_t us) noexcept;
+    void merge(const StageHistogram &other) noexcept;
+    uint64_t count() const noexcept;
+    // Upper bound of the bucket holding the percentile, in us
+    uint64_t percentile(const double p) const noexcept;
+};
+
+class Tracer
+{
+    struct Event
+    {
+        const char *stage_;
+        uint64_t startUs_;
+        uint64_t durationUs_;
+        int threadId_;
+    };
+
+    static inline bool enabled_ = false;
+    fs::path tracePath_;
+    fs::path statsPath_;
+    std::vector<Event> events_;
+    std::map<std::string, StageHistogram> stages_;
+    // Spans end on the threads loading pages as well
+    std::mutex mutex_;
+
+    Tracer() = default;
+    void writeTrace() const;
+    void writeStats();
+
+    public:
+    static Tracer &instance();
+    static bool enabled() noexcept { return enabled_; }
+    static uint64_t nowUs() noexcept;
+
+    // Writes the spans as Chrome trace JSON to path
+    void traceTo(const fs::path &path);
+    // Collects the spans into the histograms in path
+    void collectStats(const fs::path &path);
+
+    void record(const char *stage, const uint64_t startUs,
+            const uint64_t endUs);
+    // Writes out what got recorded so far, call before exiting
+    void flush();
+    // Drops what is left and records nothing from now on
+    void stop();
+};
+
+class TraceSpan
+{
+    const char *stage_;
+    uint64_t startUs_ = 0;
+
+    public:
+    explicit TraceSpan(const char *stage) noexcept : stage_{stage}
+    {
+        if (Tracer::enabled())
+            startUs_ = Tracer::nowUs();
+    }
+    ~TraceSpan()
+    {
+        if (startUs_ != 0)
+            Tracer::instance().record(stage_, startUs_, Tracer::nowUs());
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+};
+
+std::map<std::string, StageHistogram> loadStats(const fs::path &path);
+void printStats(const fs::path &path);
+
+#endif // __WLCLIPMGR_TRACE_HPP